@@ -0,0 +1,107 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "mapped_file.h"
+
+DEFINE_int32(threads, 0,
+             "Number of worker threads. 0 means the number of CPUs.");
+
+// Verifies many solutions of one problem. The .desc is parsed and
+// rasterized once into a Terrain shared by all workers; each worker keeps
+// its own Map on it and rewinds it to the initial snapshot between
+// solutions, which only touches the rows the previous solution changed.
+//
+// Prints a tab separated table, one row per solution in the given order:
+//   solution valid time failure_step failure remaining
+// where failure_step is -1 if all instructions were valid. A malformed
+// instruction fails as UNKNOWN_INSTRUCTION, and a solution which can't be
+// read as MISSING_FILE at step 0, so that one bad candidate doesn't take
+// the rest of the batch down.
+int main(int argc, char* argv[]) {
+  gflags::SetUsageMessage(
+      "batch_verifier prob-XXX.desc [a.sol b.sol ...]\n"
+      "Reads .sol paths from stdin, one per line, if none is given.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  if (argc < 2) {
+    gflags::ShowUsageWithFlags(argv[0]);
+    return 2;
+  }
+
+  std::vector<std::string> paths(argv + 2, argv + argc);
+  if (paths.empty()) {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      if (!line.empty())
+        paths.push_back(line);
+    }
+  }
+
+  const auto terrain = std::make_shared<const icfpc2019::Terrain>(
+      icfpc2019::ParseDesc(icfpc2019::MappedFile(argv[1]).contents()));
+
+  int num_threads = FLAGS_threads > 0
+      ? FLAGS_threads : std::thread::hardware_concurrency();
+  num_threads = std::max(1, std::min<int>(num_threads, paths.size()));
+
+  std::vector<icfpc2019::VerifyResult> results(paths.size());
+  // Not std::vector<bool>, which workers can't write concurrently.
+  std::vector<char> missing(paths.size(), 0);
+  std::atomic<std::size_t> next(0);
+  auto worker = [&]() {
+    icfpc2019::Map map(terrain);
+    const auto initial = map.TakeSnapshot();
+    while (true) {
+      const std::size_t i = next++;
+      if (i >= paths.size())
+        break;
+      const auto file = icfpc2019::MappedFile::TryOpen(paths[i]);
+      if (!file) {
+        PLOG(ERROR) << "Failed to open " << paths[i];
+        missing[i] = 1;
+        results[i].remaining = initial.remaining();
+        continue;
+      }
+      map.Restore(initial);
+      icfpc2019::SolutionReader sol(file->contents());
+      results[i] = icfpc2019::Simulate(&map, &sol);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  bool all_valid = true;
+  std::cout << "solution\tvalid\ttime\tfailure_step\tfailure\tremaining\n";
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    const auto& result = results[i];
+    if (missing[i]) {
+      std::cout << paths[i] << "\t0\t0\t0\tMISSING_FILE\t"
+                << result.remaining << '\n';
+      all_valid = false;
+      continue;
+    }
+    const bool failed = result.failure != icfpc2019::Map::RunResult::SUCCESS;
+    std::cout << paths[i] << '\t' << result.success() << '\t'
+              << result.steps << '\t' << (failed ? result.steps : -1) << '\t'
+              << result.failure << '\t' << result.remaining << '\n';
+    all_valid = all_valid && result.success();
+  }
+  return !all_valid;
+}
@@ -0,0 +1,229 @@
+#include "beam_search.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/types/optional.h"
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Compaction runs when the tree has grown to twice its size after the last
+// one, but not before it holds this many layers of a full beam.
+constexpr std::size_t kMinCompactLayers = 8;
+
+bool Better(double score1, std::uint64_t hash1,
+            double score2, std::uint64_t hash2) {
+  // Ties are broken by hash, so that runs are reproducible.
+  return score1 != score2 ? score1 > score2 : hash1 < hash2;
+}
+
+}  // namespace
+
+BeamSearch::BeamSearch(Map* map, BeamScorer scorer, BeamSearchOptions options)
+    : map_(map), scorer_(std::move(scorer)), options_(options) {
+  CHECK_GT(options_.beam_width, 0);
+}
+
+BeamSearchResult BeamSearch::Run() {
+  BeamSearchResult result;
+  nodes_.assign(1, Node{-1, Instruction{}});
+  beam_.assign(1, 0);
+  current_ = 0;
+  current_depth_ = 0;
+  expanded_ = 0;
+  if (map_->remaining() == 0) {
+    result.solved = true;
+    return result;
+  }
+
+  absl::optional<Clock::time_point> deadline;
+  if (options_.time_limit.count() > 0)
+    deadline = Clock::now() + options_.time_limit;
+  int width = options_.beam_width;
+  std::size_t compact_at = kMinCompactLayers * options_.beam_width;
+
+  for (int depth = 0; !beam_.empty(); ++depth) {
+    if (options_.max_steps > 0 && depth == options_.max_steps)
+      break;
+    candidates_.clear();
+    seen_.clear();
+    for (const auto node : beam_) {
+      MoveTo(node, depth);
+      if (Expand(node)) {
+        result.solved = true;
+        result.program = PathTo(node);
+        result.program.push_back(candidates_.back().inst);
+        map_->UndoStep();
+        break;
+      }
+      if (deadline && width > 1 && Clock::now() >= *deadline) {
+        LOG(INFO) << "Time limit at step " << depth << "; finishing greedily";
+        width = 1;
+      }
+    }
+    if (result.solved)
+      break;
+    if (width < options_.beam_width)
+      ++result.greedy_steps;
+    Select(width);
+    if (nodes_.size() >= compact_at) {
+      Compact();
+      compact_at = std::max(2 * nodes_.size(), compact_at);
+    }
+  }
+
+  MoveTo(0, 0);
+  result.expanded = expanded_;
+  return result;
+}
+
+void BeamSearch::MoveTo(std::int32_t node, int depth) {
+  const std::int32_t target = node;
+  // Instructions from the common ancestor down to |target|, in reverse.
+  path_.clear();
+  for (; depth > current_depth_; --depth) {
+    path_.push_back(nodes_[node].inst);
+    node = nodes_[node].parent;
+  }
+  for (; current_depth_ > depth; --current_depth_) {
+    map_->UndoStep();
+    current_ = nodes_[current_].parent;
+  }
+  while (current_ != node) {
+    map_->UndoStep();
+    current_ = nodes_[current_].parent;
+    --current_depth_;
+    path_.push_back(nodes_[node].inst);
+    node = nodes_[node].parent;
+  }
+  for (auto iter = path_.rbegin(); iter != path_.rend(); ++iter) {
+    CHECK(map_->Step(absl::MakeConstSpan(&*iter, 1)).ok())
+        << "Replay failed at " << *iter;
+  }
+  current_ = target;
+  current_depth_ += path_.size();
+}
+
+bool BeamSearch::Expand(std::int32_t parent) {
+  const auto actions = map_->LegalActions(0);
+  auto try_child = [&](const Instruction& inst) {
+    if (!map_->Step(absl::MakeConstSpan(&inst, 1)).ok())
+      return false;
+    ++expanded_;
+    if (map_->remaining() == 0) {
+      candidates_.push_back(Candidate{parent, inst, map_->hash(), 0});
+      return true;
+    }
+    const Candidate cand{parent, inst, map_->hash(), scorer_(*map_)};
+    map_->UndoStep();
+    const auto inserted = seen_.emplace(cand.hash, candidates_.size());
+    if (inserted.second) {
+      candidates_.push_back(cand);
+    } else {
+      // The same state reached from another parent.
+      auto& other = candidates_[inserted.first->second];
+      if (cand.score > other.score)
+        other = cand;
+    }
+    return false;
+  };
+
+  for (int i = 0; i <= static_cast<int>(Instruction::Type::C); ++i) {
+    const auto type = static_cast<Instruction::Type>(i);
+    if (!actions.Has(type) || type == Instruction::Type::Z ||
+        type == Instruction::Type::C || type == Instruction::Type::B ||
+        type == Instruction::Type::T)
+      continue;
+    if (try_child(Instruction{type}))
+      return true;
+  }
+  for (const auto& arg : actions.manipulators) {
+    if (try_child(Instruction{Instruction::Type::B, arg}))
+      return true;
+  }
+  for (const auto& arg : actions.teleports) {
+    if (try_child(Instruction{Instruction::Type::T, arg}))
+      return true;
+  }
+  return false;
+}
+
+void BeamSearch::Select(int width) {
+  if (static_cast<int>(candidates_.size()) > width) {
+    std::nth_element(
+        candidates_.begin(), candidates_.begin() + width, candidates_.end(),
+        [](const Candidate& a, const Candidate& b) {
+          return Better(a.score, a.hash, b.score, b.hash);
+        });
+    candidates_.resize(width);
+  }
+  // In path order, as the parents are.
+  std::sort(candidates_.begin(), candidates_.end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.parent != b.parent ? a.parent < b.parent
+                                          : a.hash < b.hash;
+            });
+  beam_.clear();
+  for (const auto& cand : candidates_) {
+    beam_.push_back(nodes_.size());
+    nodes_.push_back(Node{cand.parent, cand.inst});
+  }
+}
+
+void BeamSearch::Compact() {
+  // Marks the live nodes by a non-negative |remap|, then renumbers them in
+  // the same order, so that parents still precede their children.
+  std::vector<std::int32_t> remap(nodes_.size(), -1);
+  auto mark = [&](std::int32_t node) {
+    for (; node >= 0 && remap[node] < 0; node = nodes_[node].parent) {
+      remap[node] = 0;
+    }
+  };
+  for (const auto node : beam_) {
+    mark(node);
+  }
+  mark(current_);
+
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < nodes_.size(); ++i) {
+    if (remap[i] < 0)
+      continue;
+    remap[i] = size;
+    const auto parent = nodes_[i].parent;
+    nodes_[size] = nodes_[i];
+    nodes_[size].parent = parent < 0 ? -1 : remap[parent];
+    ++size;
+  }
+  VLOG(1) << "Compacted " << nodes_.size() << " nodes to " << size;
+  nodes_.resize(size);
+  for (auto& node : beam_) {
+    node = remap[node];
+  }
+  current_ = remap[current_];
+}
+
+Program BeamSearch::PathTo(std::int32_t node) const {
+  Program program;
+  for (; nodes_[node].parent >= 0; node = nodes_[node].parent) {
+    program.push_back(nodes_[node].inst);
+  }
+  std::reverse(program.begin(), program.end());
+  return program;
+}
+
+double WrapDistanceScore(const Map& map) {
+  const auto* field = map.distance_field();
+  CHECK(field) << "WrapDistanceScore needs Map::EnableDistanceField()";
+  if (map.remaining() == 0)
+    return 0;
+  // Any wrapped cell outweighs the distance, which is below the map size.
+  const double cell_weight = static_cast<double>(map.width()) * map.height();
+  return -cell_weight * map.remaining() -
+      field->Distance(map.wrappers()[0].point());
+}
+
+}  // namespace icfpc2019
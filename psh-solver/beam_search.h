@@ -0,0 +1,110 @@
+#ifndef BEAM_SEARCH_H_
+#define BEAM_SEARCH_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "simulator.h"
+
+namespace icfpc2019 {
+
+// Scores a state; higher is better. Called on the working Map right after
+// each child step, so it sees the exact simulator state (drilling,
+// teleports, visibility and all).
+using BeamScorer = std::function<double(const Map&)>;
+
+struct BeamSearchOptions {
+  // Number of states kept per time unit.
+  int beam_width = 100;
+  // Wall time after which the search narrows the beam to 1, i.e. finishes
+  // greedily, so that a solution is still produced. Zero for no limit.
+  std::chrono::milliseconds time_limit{0};
+  // Gives up after this many time units. Zero for no limit.
+  int max_steps = 0;
+};
+
+struct BeamSearchResult {
+  bool solved = false;
+  // Instructions of the first wrapper, from the state the search started.
+  Program program;
+  // Children generated and scored.
+  std::int64_t expanded = 0;
+  // Layers run with the narrowed beam after the time limit.
+  int greedy_steps = 0;
+};
+
+// Beam search over time units on a single working Map. Each time unit,
+// the first wrapper takes one of its legal actions, but Z and C, and the
+// others (if any) stay idle.
+//
+// The beam holds no states: only nodes of the tree of paths (a parent and
+// the instruction from it) and the hash and score of each state. A state
+// is rematerialized by undoing the working Map up to the common ancestor
+// with the previously visited one and replaying from there, and the beam
+// is visited in path order so that consecutive states share most of their
+// paths. Children are made by Step() and UndoStep(), and those with the
+// same Map::hash() within a layer are merged.
+class BeamSearch {
+ public:
+  // |map| is the working state, which must be undoable all the way (no
+  // undo limit). It is back in the initial state when Run() returns.
+  BeamSearch(Map* map, BeamScorer scorer, BeamSearchOptions options);
+
+  BeamSearchResult Run();
+
+ private:
+  struct Node {
+    std::int32_t parent;
+    Instruction inst;
+  };
+
+  struct Candidate {
+    std::int32_t parent;
+    Instruction inst;
+    std::uint64_t hash;
+    double score;
+  };
+
+  // Moves the working Map from |current_| to |node|, both at |depth|.
+  void MoveTo(std::int32_t node, int depth);
+
+  // Scores every child of the current state into |candidates_|. Returns
+  // true if one of them wraps the map, leaving the Map in that child.
+  bool Expand(std::int32_t parent);
+
+  // Keeps the |width| best candidates as the next beam.
+  void Select(int width);
+
+  // Drops nodes which are not on the path to the beam or |current_|.
+  void Compact();
+
+  Program PathTo(std::int32_t node) const;
+
+  Map* const map_;
+  const BeamScorer scorer_;
+  const BeamSearchOptions options_;
+
+  std::vector<Node> nodes_;
+  // Node indices of the current layer, in increasing (i.e. path) order.
+  std::vector<std::int32_t> beam_;
+  std::vector<Candidate> candidates_;
+  // Index in |candidates_| of each state of the next layer.
+  std::unordered_map<std::uint64_t, std::size_t> seen_;
+  // Node of the working Map, and its depth.
+  std::int32_t current_ = 0;
+  int current_depth_ = 0;
+  // Scratch space of MoveTo().
+  std::vector<Instruction> path_;
+  std::int64_t expanded_ = 0;
+};
+
+// Stock heuristic: wrapped cells first, then closeness to the nearest
+// unwrapped cell. Needs Map::EnableDistanceField().
+double WrapDistanceScore(const Map& map);
+
+}  // namespace icfpc2019
+
+#endif  // BEAM_SEARCH_H_
@@ -0,0 +1,93 @@
+#include "beam_search.h"
+
+#include <chrono>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace icfpc2019 {
+namespace {
+
+// 20x10 room with a pillar, and some boosters.
+Desc MakeDesc() {
+  Desc desc;
+  desc.map_ = {{0, 0}, {20, 0}, {20, 10}, {0, 10}};
+  desc.point = {0, 0};
+  desc.obstacles = {{{8, 3}, {12, 3}, {12, 7}, {8, 7}}};
+  desc.boosters = {
+    {{2, 2}, Booster::B}, {{5, 1}, Booster::F}, {{15, 8}, Booster::L},
+    {{18, 1}, Booster::R}, {{3, 8}, Booster::X}, {{4, 8}, Booster::C},
+  };
+  return desc;
+}
+
+std::string Dump(const Map& map) {
+  return map.ToString() + std::to_string(map.remaining()) + " " +
+      std::to_string(map.num_steps());
+}
+
+// Runs |program| one step per instruction on a fresh Map.
+int RemainingAfter(const Program& program) {
+  Map map(MakeDesc());
+  for (const auto& inst : program) {
+    EXPECT_TRUE(map.Step(absl::MakeConstSpan(&inst, 1)).ok()) << inst;
+  }
+  return map.remaining();
+}
+
+TEST(BeamSearchTest, Solves) {
+  Map map(MakeDesc());
+  map.EnableDistanceField();
+  const auto expected = Dump(map);
+  const auto hash = map.hash();
+
+  int scored = 0;
+  BeamSearchOptions options;
+  options.beam_width = 20;
+  BeamSearch search(&map,
+                    [&scored](const Map& m) {
+                      ++scored;
+                      return WrapDistanceScore(m);
+                    },
+                    options);
+  const auto result = search.Run();
+  ASSERT_TRUE(result.solved);
+  EXPECT_EQ(0, RemainingAfter(result.program));
+  // Every child but the solution is scored.
+  EXPECT_EQ(result.expanded - 1, scored);
+  EXPECT_EQ(0, result.greedy_steps);
+
+  // The working state is rewound.
+  EXPECT_EQ(expected, Dump(map));
+  EXPECT_EQ(hash, map.hash());
+
+  // And can be searched again, with the same result.
+  EXPECT_EQ(result.program.size(), search.Run().program.size());
+}
+
+TEST(BeamSearchTest, MaxSteps) {
+  Map map(MakeDesc());
+  map.EnableDistanceField();
+  const auto expected = Dump(map);
+  BeamSearchOptions options;
+  options.max_steps = 5;
+  const auto result = BeamSearch(&map, WrapDistanceScore, options).Run();
+  EXPECT_FALSE(result.solved);
+  EXPECT_TRUE(result.program.empty());
+  EXPECT_EQ(expected, Dump(map));
+}
+
+TEST(BeamSearchTest, FinishesGreedilyAfterTimeLimit) {
+  Map map(MakeDesc());
+  map.EnableDistanceField();
+  BeamSearchOptions options;
+  options.beam_width = 1000;
+  options.time_limit = std::chrono::milliseconds(1);
+  const auto result = BeamSearch(&map, WrapDistanceScore, options).Run();
+  ASSERT_TRUE(result.solved);
+  EXPECT_GT(result.greedy_steps, 0);
+  EXPECT_EQ(0, RemainingAfter(result.program));
+}
+
+}  // namespace
+}  // namespace icfpc2019
@@ -0,0 +1,63 @@
+#include "beam_search.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "simulator.h"
+
+DEFINE_int32(beam_width, 100, "Number of states kept per time unit.");
+DEFINE_int32(time_limit_ms, 10000,
+             "Wall time after which the search finishes greedily "
+             "(0 for no limit).");
+DEFINE_int32(max_steps, 0, "Gives up after this many time units "
+             "(0 for no limit).");
+
+namespace {
+
+std::string ReadContent(std::istream& is) {
+  return std::string(
+    std::istreambuf_iterator<char>(is),
+    std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  std::string desc_content;
+  if (argc < 2) {
+    desc_content = ReadContent(std::cin);
+  } else {
+    std::ifstream fin(argv[1]);
+    desc_content = ReadContent(fin);
+  }
+
+  icfpc2019::Map map(icfpc2019::ParseDesc(desc_content));
+  map.EnableDistanceField();
+
+  icfpc2019::BeamSearchOptions options;
+  options.beam_width = FLAGS_beam_width;
+  options.time_limit = std::chrono::milliseconds(FLAGS_time_limit_ms);
+  options.max_steps = FLAGS_max_steps;
+  icfpc2019::BeamSearch search(&map, icfpc2019::WrapDistanceScore, options);
+  const auto result = search.Run();
+  LOG(INFO) << "Expanded " << result.expanded << " children, "
+            << result.greedy_steps << " steps greedily";
+  if (!result.solved) {
+    LOG(ERROR) << "No solution within " << FLAGS_max_steps << " steps";
+    return 1;
+  }
+  for (const auto& inst : result.program)
+    std::cout << inst;
+  std::cout << std::endl;
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include "bitboard.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+namespace {
+
+// Bits [lo, hi) of a word. 0 <= lo < hi <= 64.
+std::uint64_t RangeMask(int lo, int hi) {
+  const std::uint64_t upper =
+      hi >= 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << hi) - 1;
+  return upper & ~((std::uint64_t{1} << lo) - 1);
+}
+
+}  // namespace
+
+int PopcountOr(const std::uint64_t* a, const std::uint64_t* b,
+               std::size_t n) {
+  std::size_t i = 0;
+  std::uint64_t result = 0;
+  // Nibble lookup popcount (Mula et al.), summed per 64-bit lane by SAD.
+#if defined(__AVX2__)
+  {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    for (; i + 4 <= n; i += 4) {
+      const __m256i v = _mm256_or_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+      const __m256i cnt = _mm256_add_epi8(
+          _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+          _mm256_shuffle_epi8(
+              lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+      acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, zero));
+    }
+    result += _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+        _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  }
+#elif defined(__SSSE3__)
+  {
+    const __m128i lookup = _mm_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 2 <= n; i += 2) {
+      const __m128i v = _mm_or_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+      const __m128i cnt = _mm_add_epi8(
+          _mm_shuffle_epi8(lookup, _mm_and_si128(v, low)),
+          _mm_shuffle_epi8(lookup, _mm_and_si128(_mm_srli_epi16(v, 4), low)));
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(cnt, zero));
+    }
+    result += _mm_cvtsi128_si64(acc) +
+        _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+  }
+#endif
+  for (; i < n; ++i) {
+    result += __builtin_popcountll(a[i] | b[i]);
+  }
+  return static_cast<int>(result);
+}
+
+Footprint::Footprint(const std::vector<Point>& cells) {
+  if (cells.empty())
+    return;
+  int max_x = cells[0].x, max_y = cells[0].y;
+  min_x_ = cells[0].x;
+  min_y_ = cells[0].y;
+  for (const auto& p : cells) {
+    min_x_ = std::min(min_x_, p.x);
+    min_y_ = std::min(min_y_, p.y);
+    max_x = std::max(max_x, p.x);
+    max_y = std::max(max_y, p.y);
+  }
+  CHECK_LT(max_x - min_x_, 64) << "Footprint is too wide";
+  rows_.assign(max_y - min_y_ + 1, 0);
+  for (const auto& p : cells) {
+    rows_[p.y - min_y_] |= std::uint64_t{1} << (p.x - min_x_);
+  }
+}
+
+Bitboard::Bitboard(int width, int height)
+    : width_(width), height_(height), words_per_row_((width + 63) / 64),
+      words_(static_cast<std::size_t>(words_per_row_) * height, 0) {
+}
+
+int Bitboard::Count() const {
+  return PopcountOr(words_.data(), words_.data(), words_.size());
+}
+
+int Bitboard::CountInRect(int x0, int y0, int x1, int y1) const {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, width_);
+  y1 = std::min(y1, height_);
+  if (x0 >= x1 || y0 >= y1)
+    return 0;
+
+  // Full rows are contiguous thanks to the zero padding.
+  if (x0 == 0 && x1 == width_) {
+    const auto* begin = row(y0);
+    return PopcountOr(begin, begin, (y1 - y0) * words_per_row_);
+  }
+
+  const int w0 = x0 >> 6, w1 = (x1 - 1) >> 6;
+  int result = 0;
+  for (int y = y0; y < y1; ++y) {
+    const auto* r = row(y);
+    for (int w = w0; w <= w1; ++w) {
+      const int lo = w == w0 ? (x0 & 63) : 0;
+      const int hi = w == w1 ? x1 - w * 64 : 64;
+      result += __builtin_popcountll(r[w] & RangeMask(lo, hi));
+    }
+  }
+  return result;
+}
+
+void Bitboard::Stamp(const Footprint& footprint, const Point& origin) {
+  ForEachWord(footprint, origin, [this](std::size_t w, std::uint64_t bits) {
+    words_[w] |= bits;
+  });
+}
+
+MineBitboard::MineBitboard(int width, int height)
+    : walls_(width, height), filled_(width, height) {
+}
+
+void MineBitboard::Set(const Point& p, Cell cell) {
+  switch (cell) {
+    case Cell::EMPTY:
+      walls_.Clear(p);
+      filled_.Clear(p);
+      break;
+    case Cell::FILLED:
+      walls_.Clear(p);
+      filled_.Set(p);
+      break;
+    case Cell::WALL:
+      walls_.Set(p);
+      filled_.Clear(p);
+      break;
+  }
+}
+
+int MineBitboard::CountEmpty() const {
+  return width() * height() - PopcountOr(
+      walls_.words().data(), filled_.words().data(), walls_.words().size());
+}
+
+int MineBitboard::CountEmptyInRect(int x0, int y0, int x1, int y1) const {
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, width());
+  y1 = std::min(y1, height());
+  if (x0 >= x1 || y0 >= y1)
+    return 0;
+  const int area = (x1 - x0) * (y1 - y0);
+
+  if (x0 == 0 && x1 == width()) {
+    const int n = (y1 - y0) * walls_.words_per_row();
+    return area - PopcountOr(walls_.row(y0), filled_.row(y0), n);
+  }
+
+  const int w0 = x0 >> 6, w1 = (x1 - 1) >> 6;
+  int used = 0;
+  for (int y = y0; y < y1; ++y) {
+    const auto* wall = walls_.row(y);
+    const auto* filled = filled_.row(y);
+    for (int w = w0; w <= w1; ++w) {
+      const int lo = w == w0 ? (x0 & 63) : 0;
+      const int hi = w == w1 ? x1 - w * 64 : 64;
+      used += __builtin_popcountll((wall[w] | filled[w]) & RangeMask(lo, hi));
+    }
+  }
+  return area - used;
+}
+
+int MineBitboard::CountEmptyIn(
+    const Footprint& footprint, const Point& origin) const {
+  const auto& walls = walls_.words();
+  const auto& filled = filled_.words();
+  int result = 0;
+  walls_.ForEachWord(
+      footprint, origin, [&](std::size_t w, std::uint64_t bits) {
+        result += __builtin_popcountll(bits & ~(walls[w] | filled[w]));
+      });
+  return result;
+}
+
+void MineBitboard::Stamp(const Footprint& footprint, const Point& origin) {
+  const auto& walls = walls_.words();
+  auto& filled = filled_.mutable_words();
+  walls_.ForEachWord(
+      footprint, origin, [&](std::size_t w, std::uint64_t bits) {
+        filled[w] |= bits & ~walls[w];
+      });
+}
+
+}  // namespace icfpc2019
@@ -0,0 +1,166 @@
+#ifndef BITBOARD_H_
+#define BITBOARD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Returns the number of set bits in (a[i] | b[i]) for i in [0, n).
+// Uses AVX2 or SSSE3 if the binary is compiled for it.
+int PopcountOr(const std::uint64_t* a, const std::uint64_t* b, std::size_t n);
+
+// Set of cells relative to an origin, packed into one word per row so that
+// it can be applied to a Bitboard word by word. Typically the cells wrapped
+// by a wrapper, i.e. {0, 0} plus its (visible) manipulators.
+class Footprint {
+ public:
+  // All cells must fit within 64 columns.
+  explicit Footprint(const std::vector<Point>& cells);
+
+  int min_x() const { return min_x_; }
+  int min_y() const { return min_y_; }
+
+  // rows()[i] is for y = min_y() + i, and its j-th bit for x = min_x() + j.
+  const std::vector<std::uint64_t>& rows() const { return rows_; }
+
+ private:
+  int min_x_ = 0;
+  int min_y_ = 0;
+  std::vector<std::uint64_t> rows_;
+};
+
+// One bit per cell, 64 cells per word. Each row starts at a word boundary,
+// and the padding bits at the end of the rows are always zero.
+class Bitboard {
+ public:
+  Bitboard() = default;
+  Bitboard(int width, int height);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int words_per_row() const { return words_per_row_; }
+
+  const std::uint64_t* row(int y) const {
+    return words_.data() + y * words_per_row_;
+  }
+
+  bool Get(const Point& p) const {
+    return (words_[Word(p)] >> (p.x & 63)) & 1;
+  }
+  void Set(const Point& p) { words_[Word(p)] |= Bit(p); }
+  void Clear(const Point& p) { words_[Word(p)] &= ~Bit(p); }
+
+  // Number of set cells on the whole board.
+  int Count() const;
+
+  // Number of set cells in [x0, x1) x [y0, y1), clipped to the board.
+  int CountInRect(int x0, int y0, int x1, int y1) const;
+
+  // Sets all cells of |footprint| placed at |origin|, clipped to the board.
+  void Stamp(const Footprint& footprint, const Point& origin);
+
+  // Calls fn(word_index, bits) for each board word covered by |footprint|
+  // placed at |origin|. |bits| are already clipped to the board.
+  template <typename Fn>
+  void ForEachWord(const Footprint& footprint, const Point& origin,
+                   Fn fn) const;
+
+  const std::vector<std::uint64_t>& words() const { return words_; }
+  std::vector<std::uint64_t>& mutable_words() { return words_; }
+
+ private:
+  std::size_t Word(const Point& p) const {
+    return p.y * words_per_row_ + (p.x >> 6);
+  }
+  static std::uint64_t Bit(const Point& p) {
+    return std::uint64_t{1} << (p.x & 63);
+  }
+
+  // Valid (non-padding) bits of the |w|-th word of a row.
+  std::uint64_t ValidMask(int w) const {
+    const int bits = width_ - w * 64;
+    return bits >= 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << bits) - 1;
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  int words_per_row_ = 0;
+  std::vector<std::uint64_t> words_;
+};
+
+template <typename Fn>
+void Bitboard::ForEachWord(const Footprint& footprint, const Point& origin,
+                           Fn fn) const {
+  const auto& rows = footprint.rows();
+  for (std::size_t i = 0; i < rows.size(); ++i) {
+    const int y = origin.y + footprint.min_y() + static_cast<int>(i);
+    if (y < 0 || height_ <= y)
+      continue;
+    std::uint64_t mask = rows[i];
+    int x = origin.x + footprint.min_x();
+    if (x < 0) {
+      if (x <= -64)
+        continue;
+      mask >>= -x;
+      x = 0;
+    }
+    if (mask == 0 || width_ <= x)
+      continue;
+    const int w = x >> 6;
+    const int shift = x & 63;
+    const std::size_t base = static_cast<std::size_t>(y) * words_per_row_;
+    if (const auto lo = (mask << shift) & ValidMask(w))
+      fn(base + w, lo);
+    if (shift != 0 && w + 1 < words_per_row_) {
+      if (const auto hi = (mask >> (64 - shift)) & ValidMask(w + 1))
+        fn(base + w + 1, hi);
+    }
+  }
+}
+
+// Bit-packed copy of the mine grid: walls and filled cells in separate
+// planes. Map can keep one in sync (see Map::EnableBitboard()), so that
+// planners can count cells a candidate move would wrap with a few word
+// operations instead of per-cell loops.
+class MineBitboard {
+ public:
+  MineBitboard() = default;
+  MineBitboard(int width, int height);
+
+  int width() const { return walls_.width(); }
+  int height() const { return walls_.height(); }
+
+  const Bitboard& walls() const { return walls_; }
+  const Bitboard& filled() const { return filled_; }
+
+  Cell Get(const Point& p) const {
+    return walls_.Get(p) ? Cell::WALL :
+        filled_.Get(p) ? Cell::FILLED : Cell::EMPTY;
+  }
+  void Set(const Point& p, Cell cell);
+
+  // Number of EMPTY cells on the whole board.
+  int CountEmpty() const;
+
+  // Number of EMPTY cells in [x0, x1) x [y0, y1), clipped to the board.
+  int CountEmptyInRect(int x0, int y0, int x1, int y1) const;
+
+  // Number of EMPTY cells covered by |footprint| placed at |origin|, i.e.
+  // the cells which would be newly wrapped.
+  int CountEmptyIn(const Footprint& footprint, const Point& origin) const;
+
+  // Marks the non-wall cells covered by |footprint| at |origin| FILLED.
+  void Stamp(const Footprint& footprint, const Point& origin);
+
+ private:
+  Bitboard walls_;
+  Bitboard filled_;
+};
+
+}  // namespace icfpc2019
+
+#endif  // BITBOARD_H_
@@ -0,0 +1,147 @@
+#include "bitboard.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "simulator.h"
+
+namespace icfpc2019 {
+namespace {
+
+// Random board wide enough to span several words per row.
+class BitboardTest : public testing::Test {
+ protected:
+  static constexpr int kWidth = 150;
+  static constexpr int kHeight = 40;
+
+  void SetUp() override {
+    std::mt19937 rng(1);
+    board_ = MineBitboard(kWidth, kHeight);
+    cells_.assign(kWidth * kHeight, Cell::EMPTY);
+    for (int y = 0; y < kHeight; ++y) {
+      for (int x = 0; x < kWidth; ++x) {
+        const auto cell = static_cast<Cell>(rng() % 3);
+        cells_[y * kWidth + x] = cell;
+        board_.Set(Point{x, y}, cell);
+      }
+    }
+  }
+
+  int NaiveCountEmpty(int x0, int y0, int x1, int y1) const {
+    int result = 0;
+    for (int y = std::max(y0, 0); y < std::min(y1, kHeight); ++y) {
+      for (int x = std::max(x0, 0); x < std::min(x1, kWidth); ++x) {
+        result += cells_[y * kWidth + x] == Cell::EMPTY;
+      }
+    }
+    return result;
+  }
+
+  MineBitboard board_;
+  std::vector<Cell> cells_;
+};
+
+TEST_F(BitboardTest, Get) {
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      const Point p{x, y};
+      ASSERT_EQ(cells_[y * kWidth + x], board_.Get(p));
+    }
+  }
+}
+
+TEST_F(BitboardTest, CountEmpty) {
+  EXPECT_EQ(NaiveCountEmpty(0, 0, kWidth, kHeight), board_.CountEmpty());
+  EXPECT_EQ(NaiveCountEmpty(0, 3, kWidth, 17),
+            board_.CountEmptyInRect(0, 3, kWidth, 17));
+
+  std::mt19937 rng(2);
+  for (int i = 0; i < 1000; ++i) {
+    const int x0 = static_cast<int>(rng() % (kWidth + 10)) - 5;
+    const int x1 = static_cast<int>(rng() % (kWidth + 10)) - 5;
+    const int y0 = static_cast<int>(rng() % (kHeight + 10)) - 5;
+    const int y1 = static_cast<int>(rng() % (kHeight + 10)) - 5;
+    ASSERT_EQ(NaiveCountEmpty(x0, y0, x1, y1),
+              board_.CountEmptyInRect(x0, y0, x1, y1))
+        << x0 << " " << y0 << " " << x1 << " " << y1;
+  }
+}
+
+TEST_F(BitboardTest, CountInRect) {
+  int all = 0;
+  for (const auto cell : cells_)
+    all += cell == Cell::WALL;
+  EXPECT_EQ(all, board_.walls().Count());
+  EXPECT_EQ(all, board_.walls().CountInRect(-1, -1, kWidth, kHeight + 1));
+
+  int partial = 0;
+  for (int y = 5; y < 20; ++y) {
+    for (int x = 60; x < 130; ++x)
+      partial += cells_[y * kWidth + x] == Cell::WALL;
+  }
+  EXPECT_EQ(partial, board_.walls().CountInRect(60, 5, 130, 20));
+}
+
+TEST_F(BitboardTest, Footprint) {
+  // Default manipulators plus a long arm, across word boundaries.
+  const std::vector<Point> cells = {
+    {0, 0}, {1, -1}, {1, 0}, {1, 1}, {-1, 1}, {-2, 1}, {-3, 1},
+  };
+  const Footprint footprint(cells);
+
+  for (const Point origin : {Point{0, 0}, Point{63, 10}, Point{64, 10},
+                             Point{1, 39}, Point{149, 20}, Point{127, 0}}) {
+    int expected = 0;
+    for (const auto& c : cells) {
+      const auto p = origin + c;
+      if (0 <= p.x && p.x < kWidth && 0 <= p.y && p.y < kHeight)
+        expected += cells_[p.y * kWidth + p.x] == Cell::EMPTY;
+    }
+    EXPECT_EQ(expected, board_.CountEmptyIn(footprint, origin)) << origin;
+
+    auto stamped = board_;
+    stamped.Stamp(footprint, origin);
+    EXPECT_EQ(0, stamped.CountEmptyIn(footprint, origin)) << origin;
+    EXPECT_EQ(board_.CountEmpty() - expected, stamped.CountEmpty()) << origin;
+    EXPECT_EQ(board_.walls().Count(), stamped.walls().Count()) << origin;
+  }
+}
+
+TEST(MapBitboardTest, StaysInSyncWithMap) {
+  Desc desc;
+  desc.map_ = {{0, 0}, {70, 0}, {70, 12}, {0, 12}};
+  desc.point = {1, 1};
+  desc.obstacles = {{{30, 3}, {40, 3}, {40, 8}, {30, 8}}};
+  Map map(desc);
+  map.EnableBitboard();
+
+  const Instruction::Type kMoves[] = {
+    Instruction::Type::W, Instruction::Type::S,
+    Instruction::Type::A, Instruction::Type::D,
+    Instruction::Type::Q, Instruction::Type::E,
+  };
+  std::mt19937 rng(3);
+  int ran = 0;
+  for (int i = 0; i < 2000; ++i) {
+    if (map.Run(0, Instruction{kMoves[rng() % 6]}) ==
+        Map::RunResult::SUCCESS)
+      ++ran;
+    if (i % 3 == 0 && ran > 0) {
+      map.Undo();
+      --ran;
+    }
+    ASSERT_EQ(map.remaining(), map.bitboard()->CountEmpty());
+  }
+  for (int y = 0; y < map.height(); ++y) {
+    for (int x = 0; x < map.width(); ++x) {
+      const Point p{x, y};
+      ASSERT_EQ(map[p], map.bitboard()->Get(p));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace icfpc2019
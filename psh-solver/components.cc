@@ -0,0 +1,267 @@
+#include "components.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+
+EmptyComponents::EmptyComponents(
+    const std::vector<Cell>& cells, int width, int height)
+    : width_(width), height_(height), label_(cells.size(), -1),
+      mark_(cells.size(), 0) {
+  auto& queue = queues_[0];
+  for (int start = 0; start < static_cast<int>(cells.size()); ++start) {
+    if (cells[start] != Cell::EMPTY || label_[start] >= 0)
+      continue;
+    const int id = NewComponent(start);
+    // Flood fill over the cells, as |label_| doesn't know EMPTY yet.
+    queue.assign(1, start);
+    label_[start] = id;
+    for (std::size_t head = 0; head < queue.size(); ++head) {
+      const int index = queue[head];
+      const int x = index % width_;
+      const int neighbors[] = {
+        x + 1 < width_ ? index + 1 : -1,
+        x > 0 ? index - 1 : -1,
+        index + width_ < static_cast<int>(cells.size()) ? index + width_ : -1,
+        index - width_,
+      };
+      for (const int next : neighbors) {
+        if (next < 0 || cells[next] != Cell::EMPTY || label_[next] >= 0)
+          continue;
+        label_[next] = id;
+        queue.push_back(next);
+      }
+    }
+    components_[id].size = queue.size();
+  }
+}
+
+void EmptyComponents::Remove(int index) {
+  const int id = label_[index];
+  DCHECK_GE(id, 0);
+  label_[index] = -1;
+  auto& component = components_[id];
+  if (--component.size == 0) {
+    FreeComponent(id);
+    return;
+  }
+
+  // Walk the ring of 8 cells around |index|, and group the EMPTY
+  // 4-neighbors connected along it. Those in a group are certainly still
+  // connected, so only one of each group needs to be examined.
+  constexpr int kRing[8][2] = {
+    {0, 1}, {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1},
+  };
+  const int x = index % width_, y = index / width_;
+  bool open[8];
+  for (int k = 0; k < 8; ++k) {
+    const int nx = x + kRing[k][0], ny = y + kRing[k][1];
+    open[k] = 0 <= nx && nx < width_ && 0 <= ny && ny < height_ &&
+        label_[ny * width_ + nx] >= 0;
+  }
+  int begin = 0;
+  while (begin < 8 && open[begin])
+    ++begin;
+  int starts[4];
+  int num_starts = 0;
+  bool in_group = false;
+  for (int i = 1; i <= 8; ++i) {
+    const int k = (begin + i) % 8;
+    if (!open[k]) {
+      in_group = false;
+      continue;
+    }
+    // Corners connect 4-neighbors, but cannot be a start by themselves.
+    if (k % 2 == 0 && !in_group) {
+      starts[num_starts++] = (y + kRing[k][1]) * width_ + (x + kRing[k][0]);
+      in_group = true;
+    }
+  }
+
+  if (num_starts > 1) {
+    Split(id, starts, num_starts);
+  } else if (component.representative == index) {
+    CHECK_EQ(num_starts, 1);
+    component.representative = starts[0];
+  }
+}
+
+void EmptyComponents::Split(int id, const int* starts, int k) {
+  if (++epoch_ == (1u << 30)) {
+    // |mark_| holds the epoch in upper 30 bits. Forget all marks.
+    std::fill(mark_.begin(), mark_.end(), 0);
+    epoch_ = 1;
+  }
+
+  // Union-find over the searches, which get merged when they meet.
+  int parent[4];
+  auto find = [&parent](int i) {
+    while (parent[i] != i)
+      i = parent[i];
+    return i;
+  };
+  std::size_t heads[4];
+  for (int i = 0; i < k; ++i) {
+    parent[i] = i;
+    heads[i] = 0;
+    queues_[i].assign(1, starts[i]);
+    mark_[starts[i]] = epoch_ << 2 | i;
+  }
+
+  bool finished[4] = {};
+  auto is_exhausted = [&](int root) {
+    for (int i = 0; i < k; ++i) {
+      if (find(i) == root && heads[i] < queues_[i].size())
+        return false;
+    }
+    return true;
+  };
+
+  while (true) {
+    int active = 0;
+    for (int i = 0; i < k; ++i) {
+      if (find(i) == i && !finished[i]) {
+        if (is_exhausted(i)) {
+          finished[i] = true;
+        } else {
+          ++active;
+        }
+      }
+    }
+    if (active <= 1)
+      break;
+
+    // Expand each search by one cell.
+    for (int i = 0; i < k; ++i) {
+      if (finished[find(i)] || heads[i] == queues_[i].size())
+        continue;
+      const int index = queues_[i][heads[i]++];
+      ForEachEmptyNeighbor(index, [&](int next) {
+        const auto mark = mark_[next];
+        if (mark >> 2 == epoch_) {
+          const int a = find(i), b = find(mark & 3);
+          if (a != b)
+            parent[b] = a;
+          return;
+        }
+        mark_[next] = epoch_ << 2 | i;
+        queues_[i].push_back(next);
+      });
+    }
+  }
+
+  // Each finished group is now a separate component, and the other one (if
+  // any) keeps |id|. If all finished, the largest one keeps it.
+  int keeper = -1;
+  for (int i = 0; i < k; ++i) {
+    if (find(i) == i && !finished[i])
+      keeper = i;
+  }
+  auto group_size = [&](int root) {
+    std::size_t result = 0;
+    for (int i = 0; i < k; ++i) {
+      if (find(i) == root)
+        result += queues_[i].size();
+    }
+    return result;
+  };
+  if (keeper < 0) {
+    for (int i = 0; i < k; ++i) {
+      if (find(i) == i && (keeper < 0 || group_size(i) > group_size(keeper)))
+        keeper = i;
+    }
+  }
+
+  for (int root = 0; root < k; ++root) {
+    if (find(root) != root || root == keeper)
+      continue;
+    const int new_id = NewComponent(starts[root]);
+    int moved = 0;
+    for (int i = 0; i < k; ++i) {
+      if (find(i) != root)
+        continue;
+      for (const int index : queues_[i]) {
+        label_[index] = new_id;
+      }
+      moved += queues_[i].size();
+    }
+    components_[new_id].size = moved;
+    components_[id].size -= moved;
+  }
+  components_[id].representative = starts[keeper];
+}
+
+void EmptyComponents::Add(int index) {
+  DCHECK_LT(label_[index], 0);
+  int ids[4];
+  int num_ids = 0;
+  ForEachEmptyNeighbor(index, [&](int next) {
+    const int id = label_[next];
+    if (std::find(ids, ids + num_ids, id) == ids + num_ids)
+      ids[num_ids++] = id;
+  });
+  if (num_ids == 0) {
+    const int id = NewComponent(index);
+    label_[index] = id;
+    components_[id].size = 1;
+    return;
+  }
+
+  const int target = *std::max_element(
+      ids, ids + num_ids, [this](int lhs, int rhs) {
+        return components_[lhs].size < components_[rhs].size;
+      });
+  label_[index] = target;
+  ++components_[target].size;
+  for (int i = 0; i < num_ids; ++i) {
+    if (ids[i] == target)
+      continue;
+    components_[target].size +=
+        Relabel(components_[ids[i]].representative, ids[i], target);
+    FreeComponent(ids[i]);
+  }
+}
+
+int EmptyComponents::Relabel(int start, int from, int to) {
+  auto& queue = queues_[0];
+  queue.assign(1, start);
+  label_[start] = to;
+  for (std::size_t head = 0; head < queue.size(); ++head) {
+    ForEachEmptyNeighbor(queue[head], [&](int next) {
+      if (label_[next] == from) {
+        label_[next] = to;
+        queue.push_back(next);
+      }
+    });
+  }
+  return queue.size();
+}
+
+int EmptyComponents::NewComponent(int representative) {
+  int id;
+  if (free_ids_.empty()) {
+    id = components_.size();
+    components_.emplace_back();
+  } else {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+  }
+  auto& component = components_[id];
+  component.size = 0;
+  component.representative = representative;
+  component.live_pos = live_.size();
+  live_.push_back(id);
+  return id;
+}
+
+void EmptyComponents::FreeComponent(int id) {
+  const int pos = components_[id].live_pos;
+  live_[pos] = live_.back();
+  components_[live_[pos]].live_pos = pos;
+  live_.pop_back();
+  free_ids_.push_back(id);
+}
+
+}  // namespace icfpc2019
@@ -0,0 +1,89 @@
+#ifndef COMPONENTS_H_
+#define COMPONENTS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Connected components (by 4-neighbors) of EMPTY cells, maintained
+// incrementally as cells are wrapped and unwrapped.
+//
+// Removing a cell only looks at the ring of 8 cells around it if that is
+// enough to prove the component stays connected. Otherwise BFSes from each
+// side run in lockstep until all but one of them are exhausted, so a split
+// costs O(size of the smaller parts). Adding a cell back (i.e. Map::Undo())
+// merges the neighboring components into the largest one, relabeling the
+// smaller ones.
+class EmptyComponents {
+ public:
+  EmptyComponents() = default;
+  // |cells| is the grid in Map::Index() order.
+  EmptyComponents(const std::vector<Cell>& cells, int width, int height);
+
+  int count() const { return live_.size(); }
+
+  // IDs of the current components, in no particular order.
+  const std::vector<int>& ids() const { return live_; }
+
+  // ID of the component containing |p|, or -1 if |p| is not EMPTY.
+  int id(const Point& p) const { return label_[p.y * width_ + p.x]; }
+
+  int size(int id) const { return components_[id].size; }
+  Point representative(int id) const {
+    const int index = components_[id].representative;
+    return Point{index % width_, index / width_};
+  }
+
+  // Must be called when the cell at |index| turns from EMPTY to non-EMPTY,
+  // and vice versa.
+  void Remove(int index);
+  void Add(int index);
+
+ private:
+  struct Component {
+    int size = 0;
+    int representative = 0;
+    int live_pos = 0;  // Position in |live_|.
+  };
+
+  int NewComponent(int representative);
+  void FreeComponent(int id);
+
+  // Relabels the component |from| containing |start| to |to|, and returns
+  // the number of relabeled cells.
+  int Relabel(int start, int from, int to);
+
+  // Splits the component |id| after its cell was removed, if the |k|
+  // |starts| (its neighbors) are no longer connected.
+  void Split(int id, const int* starts, int k);
+
+  template <typename Fn>
+  void ForEachEmptyNeighbor(int index, Fn fn) const {
+    const int x = index % width_;
+    if (x + 1 < width_ && label_[index + 1] >= 0) fn(index + 1);
+    if (x > 0 && label_[index - 1] >= 0) fn(index - 1);
+    if (index + width_ < static_cast<int>(label_.size()) &&
+        label_[index + width_] >= 0) fn(index + width_);
+    if (index >= width_ && label_[index - width_] >= 0) fn(index - width_);
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<int> label_;  // Component ID per cell, or -1.
+  std::vector<Component> components_;
+  std::vector<int> free_ids_;
+  std::vector<int> live_;
+
+  // Scratch space for Split() and Relabel().
+  std::vector<std::uint32_t> mark_;
+  std::uint32_t epoch_ = 0;
+  std::vector<int> queues_[4];
+};
+
+}  // namespace icfpc2019
+
+#endif  // COMPONENTS_H_
@@ -0,0 +1,130 @@
+#include "distance_field.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace icfpc2019 {
+
+DistanceField::DistanceField(
+    const std::vector<Cell>& cells, int width, int height)
+    : width_(width), height_(height), cells_(cells),
+      dist_(cells.size(), kUnreachable), touched_flag_(cells.size(), 0) {
+  std::vector<int> queue;
+  for (int i = 0; i < static_cast<int>(cells_.size()); ++i) {
+    if (cells_[i] == Cell::EMPTY) {
+      dist_[i] = 0;
+      queue.push_back(i);
+    }
+  }
+  for (std::size_t head = 0; head < queue.size(); ++head) {
+    const int index = queue[head];
+    ForEachNeighbor(index, [&](int next) {
+      if (Passable(next) && dist_[next] == kUnreachable) {
+        dist_[next] = dist_[index] + 1;
+        queue.push_back(next);
+      }
+    });
+  }
+}
+
+Point DistanceField::FirstStep(const Point& p) const {
+  Repair();
+  const int index = p.y * width_ + p.x;
+  const auto d = dist_[index];
+  if (d == 0 || d == kUnreachable)
+    return Point{0, 0};
+  constexpr Point kDirs[] = {{0, 1}, {0, -1}, {-1, 0}, {1, 0}};
+  for (const auto& dir : kDirs) {
+    const Point next = p + dir;
+    if (0 <= next.x && next.x < width_ && 0 <= next.y && next.y < height_ &&
+        dist_[next.y * width_ + next.x] == d - 1)
+      return dir;
+  }
+  return Point{0, 0};
+}
+
+void DistanceField::Invalidate(int index) const {
+  if (dist_[index] == kUnreachable)
+    return;
+  auto& queue = invalidate_queue_;
+  queue.assign(1, {index, dist_[index]});
+  dist_[index] = kUnreachable;
+  invalidated_.push_back(index);
+  for (std::size_t head = 0; head < queue.size(); ++head) {
+    const int old = queue[head].second;
+    ForEachNeighbor(queue[head].first, [&](int next) {
+      if (dist_[next] != old + 1)
+        return;
+      // Still supported by another neighbor one step closer? Note that a
+      // touched cell may not be invalidated yet, so check it is valid.
+      bool supported = false;
+      ForEachNeighbor(next, [&](int other) {
+        supported = supported ||
+            (dist_[other] == old && Passable(other) &&
+             (old != 0 || cells_[other] == Cell::EMPTY));
+      });
+      if (supported)
+        return;
+      queue.emplace_back(next, dist_[next]);
+      dist_[next] = kUnreachable;
+      invalidated_.push_back(next);
+    });
+  }
+}
+
+void DistanceField::RepairInternal() const {
+  // Cells which lost their wall-free-ness or their source-ness.
+  invalidated_.clear();
+  for (const int index : touched_) {
+    if (!Passable(index) ||
+        (cells_[index] != Cell::EMPTY && dist_[index] == 0))
+      Invalidate(index);
+  }
+
+  // Re-relax from the new sources and the boundary of the invalidated
+  // region, in the order of distance.
+  heap_.clear();
+  auto push = [this](std::int32_t d, int index) {
+    dist_[index] = d;
+    heap_.emplace_back(d, index);
+    std::push_heap(heap_.begin(), heap_.end(), std::greater<>());
+  };
+  auto seed = [&](int index) {
+    if (!Passable(index) || cells_[index] == Cell::EMPTY)
+      return;
+    std::int32_t best = kUnreachable;
+    ForEachNeighbor(index, [&](int next) {
+      if (Passable(next) && dist_[next] != kUnreachable)
+        best = std::min(best, dist_[next] + 1);
+    });
+    if (best < dist_[index])
+      push(best, index);
+  };
+  for (const int index : touched_) {
+    touched_flag_[index] = 0;
+    if (cells_[index] == Cell::EMPTY) {
+      if (dist_[index] != 0)
+        push(0, index);
+    } else {
+      seed(index);
+    }
+  }
+  touched_.clear();
+  for (const int index : invalidated_) {
+    seed(index);
+  }
+
+  while (!heap_.empty()) {
+    std::pop_heap(heap_.begin(), heap_.end(), std::greater<>());
+    const auto item = heap_.back();
+    heap_.pop_back();
+    if (item.first != dist_[item.second])
+      continue;
+    ForEachNeighbor(item.second, [&](int next) {
+      if (Passable(next) && item.first + 1 < dist_[next])
+        push(item.first + 1, next);
+    });
+  }
+}
+
+}  // namespace icfpc2019
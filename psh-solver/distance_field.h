@@ -0,0 +1,89 @@
+#ifndef DISTANCE_FIELD_H_
+#define DISTANCE_FIELD_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Distance (in moves, walls are impassable) from every cell to the nearest
+// EMPTY cell, i.e. a multi-source BFS field from all unwrapped cells.
+//
+// Cell changes are only recorded by Update(); the field is repaired lazily
+// on the next query, and only around the changed cells: cells which lose
+// all their shortest paths are invalidated, then they (and any new sources)
+// are re-relaxed from the valid boundary. Queries are O(1) afterwards.
+//
+// Queries are const but may repair the field, so a DistanceField must not
+// be queried from multiple threads at once.
+class DistanceField {
+ public:
+  static constexpr std::int32_t kUnreachable = 1 << 30;
+
+  DistanceField() = default;
+  // |cells| is the grid in Map::Index() order.
+  DistanceField(const std::vector<Cell>& cells, int width, int height);
+
+  // Must be called when the cell at |index| changes to |cell|.
+  void Update(int index, Cell cell) {
+    cells_[index] = cell;
+    if (!touched_flag_[index]) {
+      touched_flag_[index] = 1;
+      touched_.push_back(index);
+    }
+  }
+
+  // Distance from |p| to the nearest EMPTY cell, or kUnreachable.
+  std::int32_t Distance(const Point& p) const {
+    Repair();
+    return dist_[p.y * width_ + p.x];
+  }
+
+  // Direction ({0, 1}, {0, -1}, {-1, 0} or {1, 0}) of the first move from
+  // |p| toward the nearest EMPTY cell. {0, 0} if |p| itself is EMPTY or
+  // no EMPTY cell is reachable.
+  Point FirstStep(const Point& p) const;
+
+ private:
+  void Repair() const {
+    if (!touched_.empty())
+      RepairInternal();
+  }
+  void RepairInternal() const;
+
+  // Marks |index| and the cells which depended on it for their distance
+  // unknown, and appends them to |invalidated_|.
+  void Invalidate(int index) const;
+
+  bool Passable(int index) const { return cells_[index] != Cell::WALL; }
+
+  template <typename Fn>
+  void ForEachNeighbor(int index, Fn fn) const {
+    const int x = index % width_;
+    if (x + 1 < width_) fn(index + 1);
+    if (x > 0) fn(index - 1);
+    if (index + width_ < static_cast<int>(cells_.size())) fn(index + width_);
+    if (index >= width_) fn(index - width_);
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<Cell> cells_;
+
+  // Lazily repaired state.
+  mutable std::vector<std::int32_t> dist_;
+  mutable std::vector<int> touched_;
+  mutable std::vector<std::uint8_t> touched_flag_;
+
+  // Scratch space for RepairInternal().
+  mutable std::vector<std::pair<int, std::int32_t>> invalidate_queue_;
+  mutable std::vector<int> invalidated_;
+  mutable std::vector<std::pair<std::int32_t, int>> heap_;
+};
+
+}  // namespace icfpc2019
+
+#endif  // DISTANCE_FIELD_H_
@@ -0,0 +1,57 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include <cstdint>
+#include <iosfwd>
+#include <tuple>
+
+namespace icfpc2019 {
+
+struct Point {
+  int x;
+  int y;
+
+  friend bool operator==(const Point& lhs, const Point& rhs) {
+    return std::tie(lhs.x, lhs.y) == std::tie(rhs.x, rhs.y);
+  }
+  friend bool operator!=(const Point& lhs, const Point& rhs) {
+    return std::tie(lhs.x, lhs.y) != std::tie(rhs.x, rhs.y);
+  }
+  bool operator<(const Point& other) const {
+    return std::tie(x, y) < std::tie(other.x, other.y);
+  }
+
+  Point& operator+=(const Point& other) {
+    x += other.x;
+    y += other.y;
+    return *this;
+  }
+
+  Point& operator-=(const Point& other) {
+    x -= other.x;
+    y -= other.y;
+    return *this;
+  }
+
+  friend Point operator+(const Point& lhs, const Point& rhs) {
+    return {lhs.x + rhs.x, lhs.y + rhs.y};
+  }
+
+  friend Point operator-(const Point& lhs, const Point& rhs) {
+    return {lhs.x - rhs.x, lhs.y - rhs.y};
+  }
+
+};
+
+std::ostream& operator<<(std::ostream& os, const Point& point);
+std::istream& operator>>(std::istream& is, Point& point);
+
+enum class Cell : std::uint8_t {
+  EMPTY,
+  FILLED,
+  WALL,
+};
+
+}  // namespace icfpc2019
+
+#endif  // GRID_H_
@@ -0,0 +1,469 @@
+#include "idfs_search.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+namespace {
+
+constexpr int kMaxDepth = 1000;
+
+// Gives up as soon as |stop| (if any) is set.
+bool SolveInternal(Map* m, int deps, Program* current,
+                   const std::atomic<bool>* stop = nullptr) {
+  if (m->remaining() == 0)
+    return true;
+
+  if (deps == 0 || (stop && stop->load(std::memory_order_relaxed)))
+    return false;
+
+  const Instruction cands[] = {
+    {Instruction::Type::W},
+    {Instruction::Type::A},
+    {Instruction::Type::S},
+    {Instruction::Type::D},
+    {Instruction::Type::Q},
+    {Instruction::Type::E},
+  };
+
+  const auto actions = m->LegalActions(0);
+  for (const auto& cand : cands) {
+    if (actions.Has(cand.type)) {
+      m->RunUnsafe(0, cand);
+      current->push_back(cand);
+      if (SolveInternal(m, deps-1, current, stop))
+        return true;
+      current->pop_back();
+      m->Undo();
+    }
+  }
+
+  return false;
+}
+
+void Replay(Map* m, const Program& prefix) {
+  for (const auto& inst : prefix)
+    m->RunUnsafe(0, inst);
+}
+
+void Rewind(Map* m, int num_instructions) {
+  for (int i = 0; i < num_instructions; ++i)
+    m->Undo();
+}
+
+IdfsResult Solve(Map* m) {
+  IdfsResult result;
+  for (int i = 1; i < kMaxDepth; ++i) {
+    LOG(INFO) << "Trying " << i;
+    if (SolveInternal(m, i, &result.program)) {
+      Rewind(m, result.program.size());
+      result.solved = true;
+      result.lower_bound = result.program.size();
+      return result;
+    }
+  }
+  result.lower_bound = kMaxDepth;
+  return result;
+}
+
+IdfsResult SolveByIda(Map* m, const IdfsOptions& options) {
+  SearchControl control;
+  control.max_nodes = options.max_nodes;
+  TranspositionTable table(options.tt_log2);
+  IdaSearch search(m, &control, &table);
+  IdfsResult result;
+  result.solved = search.Solve(&result.program);
+  if (result.solved)
+    Rewind(m, result.program.size());
+  result.lower_bound = search.lower_bound();
+  return result;
+}
+
+// Subtree of the search below |prefix| from the root.
+struct Task {
+  Program prefix;
+};
+
+// A deque of tasks per worker. Workers take their own tasks from the back,
+// and once out of them, steal the others' from the front, so that workers
+// with small subtrees relieve those with large ones.
+class TaskDeques {
+ public:
+  TaskDeques(const std::vector<Task>& tasks, int num_workers)
+      : deques_(num_workers) {
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+      deques_[i % num_workers].tasks.push_back(&tasks[i]);
+    }
+  }
+
+  // nullptr once all deques are empty.
+  const Task* Pop(int worker) {
+    {
+      auto& own = deques_[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        const auto* task = own.tasks.back();
+        own.tasks.pop_back();
+        return task;
+      }
+    }
+    for (std::size_t i = 1; i < deques_.size(); ++i) {
+      auto& other = deques_[(worker + i) % deques_.size()];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      if (!other.tasks.empty()) {
+        const auto* task = other.tasks.front();
+        other.tasks.pop_front();
+        return task;
+      }
+    }
+    return nullptr;
+  }
+
+ private:
+  struct Deque {
+    std::mutex mutex;
+    std::deque<const Task*> tasks;
+  };
+  std::vector<Deque> deques_;
+};
+
+// Runs |fn|(worker, task) for every task on |num_workers| threads, or until
+// |stop| is set.
+template <typename Fn>
+void RunTasks(const std::vector<Task>& tasks, int num_workers,
+              const std::atomic<bool>& stop, Fn fn) {
+  TaskDeques deques(tasks, num_workers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_workers; ++i) {
+    threads.emplace_back([&, i] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        const auto* task = deques.Pop(i);
+        if (!task)
+          break;
+        fn(i, *task);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Enough subtrees per worker for stealing to even out their sizes.
+constexpr int kTasksPerWorker = 16;
+constexpr int kMaxSplitDepth = 8;
+
+// Splits the search into the distinct states at the shallowest depth with
+// at least |min_tasks| of them, by BFS from the root. States already seen
+// at a shallower depth are left out, as the earlier copy has as large a
+// budget. Returns true with |solution| instead if some prefix wraps the
+// map, which is then optimal.
+bool SplitTasks(Map* m, std::size_t min_tasks, std::vector<Task>* tasks,
+                Program* solution) {
+  const Instruction cands[] = {
+    {Instruction::Type::W},
+    {Instruction::Type::A},
+    {Instruction::Type::S},
+    {Instruction::Type::D},
+    {Instruction::Type::Q},
+    {Instruction::Type::E},
+  };
+
+  tasks->assign(1, Task{});
+  if (m->remaining() == 0) {
+    solution->clear();
+    return true;
+  }
+  std::unordered_set<std::uint64_t> seen = {m->hash()};
+  for (int depth = 0; depth < kMaxSplitDepth && tasks->size() < min_tasks;
+       ++depth) {
+    std::vector<Task> next;
+    for (const auto& task : *tasks) {
+      Replay(m, task.prefix);
+      const auto actions = m->LegalActions(0);
+      for (const auto& cand : cands) {
+        if (!actions.Has(cand.type))
+          continue;
+        m->RunUnsafe(0, cand);
+        const bool wrapped = m->remaining() == 0;
+        if (wrapped || seen.insert(m->hash()).second) {
+          next.push_back(task);
+          next.back().prefix.push_back(cand);
+        }
+        m->Undo();
+        if (wrapped) {
+          Rewind(m, task.prefix.size());
+          *solution = next.back().prefix;
+          return true;
+        }
+      }
+      Rewind(m, task.prefix.size());
+    }
+    *tasks = std::move(next);
+  }
+  return false;
+}
+
+IdfsResult SolveInParallel(Map* m, int num_workers) {
+  std::vector<Task> tasks;
+  IdfsResult result;
+  if (SplitTasks(m, num_workers * kTasksPerWorker, &tasks, &result.program)) {
+    result.solved = true;
+    result.lower_bound = result.program.size();
+    return result;
+  }
+  const int depth = tasks.empty() ? 0 : tasks.front().prefix.size();
+  LOG(INFO) << tasks.size() << " subtrees at depth " << depth;
+
+  // Shorter solutions would have been found by SplitTasks().
+  std::vector<Map> maps(num_workers, *m);
+  for (int i = depth + 1; i < kMaxDepth; ++i) {
+    LOG(INFO) << "Trying " << i;
+    std::atomic<bool> found(false);
+    std::mutex mutex;
+    RunTasks(tasks, num_workers, found, [&](int worker, const Task& task) {
+      auto* local = &maps[worker];
+      Replay(local, task.prefix);
+      auto current = task.prefix;
+      if (SolveInternal(local, i - depth, &current, &found)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!found) {
+          result.program = current;
+          found = true;
+        }
+        Rewind(local, current.size());
+        return;
+      }
+      Rewind(local, task.prefix.size());
+    });
+    if (found) {
+      result.solved = true;
+      result.lower_bound = result.program.size();
+      return result;
+    }
+  }
+  result.lower_bound = kMaxDepth;
+  return result;
+}
+
+IdfsResult SolveByIdaInParallel(Map* m, const IdfsOptions& options) {
+  const int num_workers = options.num_threads;
+  std::vector<Task> tasks;
+  IdfsResult result;
+  if (SplitTasks(m, num_workers * kTasksPerWorker, &tasks, &result.program)) {
+    result.solved = true;
+    result.lower_bound = result.program.size();
+    return result;
+  }
+  const int depth = tasks.empty() ? 0 : tasks.front().prefix.size();
+  LOG(INFO) << tasks.size() << " subtrees at depth " << depth;
+
+  SearchControl control;
+  control.max_nodes = options.max_nodes;
+  TranspositionTable table(options.tt_log2);
+  std::vector<Map> maps(num_workers, *m);
+  std::vector<std::unique_ptr<IdaSearch>> searches;
+  for (auto& map : maps) {
+    searches.push_back(std::make_unique<IdaSearch>(&map, &control, &table));
+  }
+
+  // Shorter solutions would have been found by SplitTasks().
+  int bound = tasks.empty() ? IdaSearch::kInfinity : depth + 1;
+  for (std::uint32_t iteration = 1; bound != IdaSearch::kInfinity;
+       ++iteration) {
+    std::vector<int> next_bounds(num_workers, IdaSearch::kInfinity);
+    bool found = false;
+    std::mutex mutex;
+    RunTasks(tasks, num_workers, control.stop,
+             [&](int worker, const Task& task) {
+      auto* local = &maps[worker];
+      auto& search = *searches[worker];
+      Replay(local, task.prefix);
+      const int t = search.SearchBelow(task.prefix, bound, iteration);
+      if (t == IdaSearch::kFound) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!found) {
+          result.program = search.path();
+          found = true;
+        }
+        control.stop = true;
+        Rewind(local, search.path().size());
+        return;
+      }
+      Rewind(local, task.prefix.size());
+      if (t != IdaSearch::kAborted)
+        next_bounds[worker] = std::min(next_bounds[worker], t);
+    });
+    LOG(INFO) << "Bound " << bound << ": " << control.nodes.load() << " nodes";
+    if (found) {
+      result.solved = true;
+      result.lower_bound = result.program.size();
+      return result;
+    }
+    if (control.stop)
+      break;
+    bound = *std::min_element(next_bounds.begin(), next_bounds.end());
+  }
+  result.lower_bound = bound;
+  return result;
+}
+
+}  // namespace
+
+bool IdaSearch::Solve(Program* result) {
+  bound_ = LowerBound();
+  path_.clear();
+  for (std::uint32_t iteration = 1; bound_ != kInfinity; ++iteration) {
+    iteration_ = iteration;
+    const auto next = Search(0, kNoMove, true);
+    LOG(INFO) << "Bound " << bound_ << ": " << control_->nodes.load()
+              << " nodes, " << table_hits_ << " table hits";
+    if (next == kFound) {
+      *result = path_;
+      return true;
+    }
+    if (next == kAborted)
+      return false;
+    bound_ = next;
+  }
+  return false;
+}
+
+int IdaSearch::SearchBelow(const Program& prefix, int bound,
+                           std::uint32_t iteration) {
+  bound_ = bound;
+  iteration_ = iteration;
+  path_ = prefix;
+  return Search(prefix.size(), kNoMove, true);
+}
+
+int IdaSearch::Search(int g, int last, bool last_wrapped) {
+  if (m_->remaining() == 0)
+    return kFound;
+  if (control_->stop.load(std::memory_order_relaxed))
+    return kAborted;
+  const auto nodes = control_->nodes.fetch_add(1, std::memory_order_relaxed);
+  if (control_->max_nodes > 0 && nodes >= control_->max_nodes) {
+    control_->stop = true;
+    return kAborted;
+  }
+
+  // Reached no later in this iteration already, so its subtree has been
+  // searched with as large a budget, and its f values taken into account.
+  if (table_->Visit(m_->hash(), g, iteration_)) {
+    ++table_hits_;
+    return kInfinity;
+  }
+
+  const int h = LowerBound();
+  if (h == kInfinity)
+    return kInfinity;
+  if (g + h > bound_)
+    return g + h;
+
+  int next_bound = kInfinity;
+  const auto actions = m_->LegalActions(0);
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (!actions.Has(kMoves[i]))
+      continue;
+    // Undoing an instruction which wrapped nothing just comes back.
+    if (last != kNoMove && !last_wrapped && i == (last ^ 1))
+      continue;
+    const int remaining = m_->remaining();
+    m_->RunUnsafe(0, Instruction{kMoves[i]});
+    path_.push_back(Instruction{kMoves[i]});
+    const int t = Search(g + 1, i, m_->remaining() != remaining);
+    if (t == kFound)
+      return kFound;
+    path_.pop_back();
+    m_->Undo();
+    if (t == kAborted)
+      return kAborted;
+    next_bound = std::min(next_bound, t);
+  }
+  return next_bound;
+}
+
+// Cell c is wrapped only once the wrapper stands at c or at c - o for a
+// manipulator o, rotated k quarter turns at the cost of min(k, 4 - k)
+// steps. So with cover(c), the least such walk plus turns, and cap, the
+// most cells a step can wrap,
+//   steps >= max over c of cover(c), and
+//   steps >= (min over c of cover(c)) - 1 + ceil(remaining / cap),
+// as nothing is wrapped before the nearest cell is covered.
+int IdaSearch::LowerBound() {
+  const auto& wrapper = m_->wrappers()[0];
+  const int width = m_->width();
+  const int height = m_->height();
+  Walk(wrapper.point());
+
+  offsets_.assign(1, {Point{0, 0}, 0});
+  for (auto manip : wrapper.manipulators()) {
+    for (int k = 0; k < 4; ++k) {
+      offsets_.emplace_back(manip, std::min(k, 4 - k));
+      manip = Point{manip.y, -manip.x};
+    }
+  }
+
+  int nearest = kInfinity;
+  int farthest = 0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const Point c{x, y};
+      if ((*m_)[c] != Cell::EMPTY)
+        continue;
+      int cover = kInfinity;
+      for (const auto& offset : offsets_) {
+        const auto b = c - offset.first;
+        if (!m_->InMap(b) || walk_[b.y * width + b.x] == kInfinity)
+          continue;
+        cover = std::min(cover, walk_[b.y * width + b.x] + offset.second);
+      }
+      if (cover == kInfinity)
+        return kInfinity;
+      nearest = std::min(nearest, cover);
+      farthest = std::max(farthest, cover);
+    }
+  }
+  if (nearest == kInfinity)
+    return 0;
+  const int cap = 1 + wrapper.manipulators().size();
+  return std::max(farthest, std::max(nearest, 1) - 1 +
+                  (m_->remaining() + cap - 1) / cap);
+}
+
+void IdaSearch::Walk(const Point& source) {
+  const int width = m_->width();
+  walk_.assign(width * m_->height(), kInfinity);
+  walk_[source.y * width + source.x] = 0;
+  queue_.assign(1, source);
+  constexpr Point kDirs[] = {{0, 1}, {0, -1}, {-1, 0}, {1, 0}};
+  for (std::size_t head = 0; head < queue_.size(); ++head) {
+    const auto p = queue_[head];
+    for (const auto& dir : kDirs) {
+      const auto q = p + dir;
+      if (m_->InMap(q) && (*m_)[q] != Cell::WALL &&
+          walk_[q.y * width + q.x] == kInfinity) {
+        walk_[q.y * width + q.x] = walk_[p.y * width + p.x] + 1;
+        queue_.push_back(q);
+      }
+    }
+  }
+}
+
+IdfsResult SolveByIdfs(Map* map, const IdfsOptions& options) {
+  CHECK_GT(options.num_threads, 0);
+  if (options.num_threads > 1) {
+    return options.ida ? SolveByIdaInParallel(map, options)
+                       : SolveInParallel(map, options.num_threads);
+  }
+  return options.ida ? SolveByIda(map, options) : Solve(map);
+}
+
+}  // namespace icfpc2019
@@ -0,0 +1,149 @@
+#ifndef IDFS_SEARCH_H_
+#define IDFS_SEARCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "simulator.h"
+
+namespace icfpc2019 {
+
+struct IdfsOptions {
+  // Runs IDA* with a lower bound, a transposition table and move pruning
+  // instead of plain iterative deepening.
+  bool ida = false;
+  // log2 of the number of transposition table entries for IDA*.
+  int tt_log2 = 22;
+  // Gives IDA* up after this many nodes. Zero for no limit.
+  std::int64_t max_nodes = 0;
+  // With more than one, the search is split into subtrees at a shallow
+  // depth, which the workers share by work stealing.
+  int num_threads = 1;
+};
+
+struct IdfsResult {
+  bool solved = false;
+  // Instructions of the first wrapper, from the state the search started.
+  Program program;
+  // Every solution takes at least this many steps: the length of
+  // |program| if solved, or what was proven before giving up.
+  // IdaSearch::kInfinity if the map can't be wrapped.
+  int lower_bound = 0;
+};
+
+// Finds a shortest program over moves and turns of the first wrapper,
+// which wraps |map|. The map is back in its state on return.
+IdfsResult SolveByIdfs(Map* map, const IdfsOptions& options);
+
+// State shared by the searches of all workers.
+struct SearchControl {
+  // Set once a worker finds a solution or gives up.
+  std::atomic<bool> stop{false};
+  std::atomic<std::int64_t> nodes{0};
+  // Zero for no limit.
+  std::int64_t max_nodes = 0;
+};
+
+// Least steps from the root at which each state has been reached in an
+// iteration of IDA*. Lockless so that workers can share it: an entry holds
+// its key XORed with its data, so an entry torn by racing writers just
+// doesn't match.
+class TranspositionTable {
+ public:
+  explicit TranspositionTable(int log2) : entries_(std::size_t{1} << log2) {}
+
+  // Whether |key| has been reached at |g| or less in |iteration|. Records
+  // it otherwise.
+  bool Visit(std::uint64_t key, std::int32_t g, std::uint32_t iteration) {
+    auto& entry = entries_[key & (entries_.size() - 1)];
+    const auto data = entry.data.load(std::memory_order_relaxed);
+    if ((entry.check.load(std::memory_order_relaxed) ^ data) == key &&
+        static_cast<std::uint32_t>(data >> 32) == iteration &&
+        static_cast<std::int32_t>(data) <= g)
+      return true;
+    const auto new_data =
+        std::uint64_t{iteration} << 32 | static_cast<std::uint32_t>(g);
+    entry.check.store(key ^ new_data, std::memory_order_relaxed);
+    entry.data.store(new_data, std::memory_order_relaxed);
+    return false;
+  }
+
+ private:
+  struct Entry {
+    std::atomic<std::uint64_t> check{0};
+    std::atomic<std::uint64_t> data{0};
+  };
+  std::vector<Entry> entries_;
+};
+
+// IDA* over the same instructions as plain iterative deepening, so that
+// its solutions are optimal among those using moves and turns of the first
+// wrapper only.
+class IdaSearch {
+ public:
+  static constexpr int kInfinity = std::numeric_limits<int>::max();
+  static constexpr int kFound = -1;
+  static constexpr int kAborted = -2;
+
+  IdaSearch(Map* m, SearchControl* control, TranspositionTable* table)
+      : m_(m), control_(control), table_(table) {}
+
+  // Finds an optimal solution into |result|. Returns false if the search
+  // gave up on SearchControl::max_nodes or the map can't be wrapped, with
+  // the proven lower bound in lower_bound().
+  bool Solve(Program* result);
+
+  // Runs |iteration| with |bound| below the current state of the map, which
+  // |prefix| leads to from the root. Returns kFound with the solution in
+  // path(), kAborted, or the least f above |bound| (kInfinity if none). The
+  // map is back in the state on return, unless kFound.
+  int SearchBelow(const Program& prefix, int bound, std::uint32_t iteration);
+
+  // Admissible estimate of the steps left from the current state of the
+  // map, or kInfinity if some EMPTY cell can't be wrapped.
+  int LowerBound();
+
+  // Every solution takes at least this many steps.
+  int lower_bound() const { return bound_; }
+  const Program& path() const { return path_; }
+  std::int64_t table_hits() const { return table_hits_; }
+
+ private:
+  static constexpr int kNoMove = -1;
+
+  // Returns kFound, kAborted, or the least f above the bound in the
+  // subtree (kInfinity if none). |last| is the index of the instruction
+  // leading here in kMoves, and |last_wrapped| whether it wrapped any cell.
+  int Search(int g, int last, bool last_wrapped);
+
+  // Fills |walk_| with the moves from |source| to every cell.
+  void Walk(const Point& source);
+
+  // Each next to its inverse, i.e. kMoves[i ^ 1] undoes kMoves[i].
+  static constexpr Instruction::Type kMoves[] = {
+    Instruction::Type::W, Instruction::Type::S,
+    Instruction::Type::A, Instruction::Type::D,
+    Instruction::Type::Q, Instruction::Type::E,
+  };
+  static constexpr int kNumMoves = 6;
+
+  Map* m_;
+  SearchControl* control_;
+  TranspositionTable* table_;
+  int bound_ = 0;
+  std::uint32_t iteration_ = 0;
+  std::int64_t table_hits_ = 0;
+  Program path_;
+
+  // Scratch space for LowerBound().
+  std::vector<int> walk_;
+  std::vector<Point> queue_;
+  std::vector<std::pair<Point, int>> offsets_;
+};
+
+}  // namespace icfpc2019
+
+#endif  // IDFS_SEARCH_H_
@@ -0,0 +1,166 @@
+#include "idfs_search.h"
+
+#include <random>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace icfpc2019 {
+namespace {
+
+// Small enough for plain iterative deepening: a room of up to 4x4, with a
+// pillar inside sometimes.
+Desc MakeRoom(int seed) {
+  std::mt19937 rng(seed);
+  auto uniform = [&rng](int lo, int hi) {
+    return std::uniform_int_distribution<int>(lo, hi)(rng);
+  };
+  const int w = uniform(2, 4);
+  const int h = uniform(2, 4);
+  Desc desc;
+  desc.map_ = {{0, 0}, {w, 0}, {w, h}, {0, h}};
+  desc.point = {uniform(0, w - 1), uniform(0, h - 1)};
+  if (w >= 3 && h >= 3 && uniform(0, 1)) {
+    const Point p{uniform(1, w - 2), uniform(1, h - 2)};
+    if (!(p == desc.point))
+      desc.obstacles = {
+        {p, {p.x + 1, p.y}, {p.x + 1, p.y + 1}, {p.x, p.y + 1}}};
+  }
+  return desc;
+}
+
+// Runs |program| on wrapper 0 and returns the cells left.
+int RemainingAfter(Map map, const Program& program) {
+  for (const auto& inst : program) {
+    EXPECT_EQ(Map::RunResult::SUCCESS, map.Run(0, inst)) << inst;
+  }
+  return map.remaining();
+}
+
+IdfsOptions IdaOptions() {
+  IdfsOptions options;
+  options.ida = true;
+  options.tt_log2 = 16;
+  return options;
+}
+
+constexpr int kNumRooms = 100;
+
+TEST(IdfsSearchTest, IdaMatchesPlainSearch) {
+  for (int seed = 0; seed < kNumRooms; ++seed) {
+    Map map(MakeRoom(seed));
+    const auto expected = map.ToString();
+    const auto plain = SolveByIdfs(&map, IdfsOptions());
+    ASSERT_TRUE(plain.solved) << seed;
+    EXPECT_EQ(expected, map.ToString()) << seed;
+    const auto ida = SolveByIdfs(&map, IdaOptions());
+    ASSERT_TRUE(ida.solved) << seed;
+    EXPECT_EQ(expected, map.ToString()) << seed;
+    EXPECT_EQ(plain.program.size(), ida.program.size()) << seed;
+    EXPECT_EQ(0, RemainingAfter(map, ida.program)) << seed;
+  }
+}
+
+TEST(IdfsSearchTest, Prob001) {
+  // problems/prob-001.desc.
+  Map map(ParseDesc(
+      "(0,0),(6,0),(6,1),(8,1),(8,2),(6,2),(6,3),(0,3)#(0,0)##"));
+  const auto result = SolveByIdfs(&map, IdaOptions());
+  ASSERT_TRUE(result.solved);
+  EXPECT_EQ(9u, result.program.size());
+  EXPECT_EQ(0, RemainingAfter(map, result.program));
+  EXPECT_EQ(9u, SolveByIdfs(&map, IdfsOptions()).program.size());
+}
+
+// Serial and parallel searches find programs of the same length.
+void ExpectParallelMatchesSerial(const Desc& desc, const std::string& name) {
+  Map map(desc);
+  const auto expected = map.ToString();
+  const auto serial = SolveByIdfs(&map, IdfsOptions());
+  ASSERT_TRUE(serial.solved) << name;
+  for (const bool ida : {false, true}) {
+    auto options = ida ? IdaOptions() : IdfsOptions();
+    options.num_threads = 4;
+    const auto parallel = SolveByIdfs(&map, options);
+    ASSERT_TRUE(parallel.solved) << name << " ida=" << ida;
+    EXPECT_EQ(serial.program.size(), parallel.program.size())
+        << name << " ida=" << ida;
+    EXPECT_EQ(0, RemainingAfter(map, parallel.program))
+        << name << " ida=" << ida;
+    EXPECT_EQ(expected, map.ToString()) << name << " ida=" << ida;
+  }
+}
+
+TEST(IdfsSearchTest, ParallelMatchesSerial) {
+  for (int seed = 0; seed < kNumRooms; ++seed) {
+    ExpectParallelMatchesSerial(MakeRoom(seed), std::to_string(seed));
+  }
+  ExpectParallelMatchesSerial(
+      ParseDesc("(0,0),(6,0),(6,1),(8,1),(8,2),(6,2),(6,3),(0,3)#(0,0)##"),
+      "prob-001");
+}
+
+TEST(IdfsSearchTest, ParallelWithPrefixWrappingMap) {
+  // Wrapped before the search is split into enough subtrees: at the root,
+  // and by the first move.
+  const Desc wrapped_at_root = ParseDesc("(0,0),(1,0),(1,1),(0,1)#(0,0)##");
+  const Desc wrapped_by_move = ParseDesc("(0,0),(2,0),(2,2),(0,2)#(0,0)##");
+  ASSERT_EQ(0, Map(wrapped_at_root).remaining());
+  ExpectParallelMatchesSerial(wrapped_at_root, "root");
+  ExpectParallelMatchesSerial(wrapped_by_move, "move");
+
+  Map map(wrapped_by_move);
+  for (const bool ida : {false, true}) {
+    auto options = ida ? IdaOptions() : IdfsOptions();
+    options.num_threads = 4;
+    EXPECT_EQ(1u, SolveByIdfs(&map, options).program.size()) << ida;
+  }
+}
+
+TEST(IdfsSearchTest, GivesUpWithLowerBound) {
+  Map map(ParseDesc(
+      "(0,0),(6,0),(6,1),(8,1),(8,2),(6,2),(6,3),(0,3)#(0,0)##"));
+  auto options = IdaOptions();
+  options.max_nodes = 10;
+  const auto result = SolveByIdfs(&map, options);
+  EXPECT_FALSE(result.solved);
+  EXPECT_GT(result.lower_bound, 0);
+  EXPECT_LE(result.lower_bound, 9);
+}
+
+TEST(IdfsSearchTest, LowerBoundIsAdmissible) {
+  std::mt19937 rng(1);
+  for (int seed = 0; seed < kNumRooms; ++seed) {
+    Map map(MakeRoom(seed));
+    SearchControl control;
+    TranspositionTable table(8);
+    IdaSearch search(&map, &control, &table);
+
+    // Along an optimal path, the rest of it is optimal.
+    const auto program = SolveByIdfs(&map, IdfsOptions()).program;
+    for (std::size_t i = 0; i < program.size(); ++i) {
+      EXPECT_LE(search.LowerBound(), static_cast<int>(program.size() - i))
+          << seed << " " << i;
+      map.Run(0, program[i]);
+    }
+    EXPECT_EQ(0, search.LowerBound()) << seed;
+
+    // And off it.
+    Map wandered(MakeRoom(seed));
+    IdaSearch wandered_search(&wandered, &control, &table);
+    for (int i = 0; i < 3; ++i) {
+      const Instruction inst{static_cast<Instruction::Type>(rng() % 6)};
+      if (wandered.Run(0, inst) != Map::RunResult::SUCCESS)
+        continue;
+      const auto rest = SolveByIdfs(&wandered, IdfsOptions());
+      if (!rest.solved)
+        break;
+      EXPECT_LE(wandered_search.LowerBound(),
+                static_cast<int>(rest.program.size()))
+          << seed << " " << i;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace icfpc2019
@@ -1,13 +1,29 @@
-#include "simulator.h"
+#include "idfs_search.h"
 
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <string>
+#include <thread>
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "simulator.h"
+
+DEFINE_bool(ida, false,
+            "Runs IDA* with a lower bound, a transposition table and move "
+            "pruning instead of plain iterative deepening.");
+DEFINE_int32(tt_log2, 22,
+             "log2 of the number of transposition table entries for --ida.");
+DEFINE_int64(max_nodes, 0,
+             "Gives --ida up after this many nodes (0 for no limit), "
+             "printing the lower bound proven so far.");
+DEFINE_int32(threads, 1,
+             "Number of worker threads. 0 means the number of CPUs. With "
+             "more than one, the search is split into subtrees at a shallow "
+             "depth, which the workers share by work stealing.");
+
 namespace {
 
 std::string ReadContent(std::istream& is) {
@@ -16,49 +32,6 @@ std::string ReadContent(std::istream& is) {
     std::istreambuf_iterator<char>());
 }
 
-bool SolveInternal(icfpc2019::Map* m, int deps,
-                   std::vector<icfpc2019::Instruction>* current) {
-  if (m->remaining() == 0)
-    return true;
-
-  if (deps == 0)
-    return false;
-
-  const icfpc2019::Instruction cands[] = {
-    {icfpc2019::Instruction::Type::W},
-    {icfpc2019::Instruction::Type::A},
-    {icfpc2019::Instruction::Type::S},
-    {icfpc2019::Instruction::Type::D},
-    {icfpc2019::Instruction::Type::Q},
-    {icfpc2019::Instruction::Type::E},
-  };
-
-  for (const auto& cand : cands) {
-    if (m->Run(0, cand) == icfpc2019::Map::RunResult::SUCCESS) {
-      current->push_back(cand);
-      if (SolveInternal(m, deps-1, current))
-        return true;
-      current->pop_back();
-      m->Undo();
-    }
-  }
-
-  return false;
-}
-
-void Solve(icfpc2019::Map* m) {
-  for (int i = 1; i < 1000; ++i) {
-    LOG(INFO) << "Trying " << i;
-    std::vector<icfpc2019::Instruction> result;
-    if (SolveInternal(m, i, &result)) {
-      for (const auto& inst : result)
-        std::cout << inst;
-      std::cout << std::endl;
-      return;
-    }
-  }
-}
-
 }  // namespace
 
 
@@ -78,5 +51,20 @@ int main(int argc, char* argv[]) {
   auto desc = icfpc2019::ParseDesc(desc_content);
   auto map = icfpc2019::Map(desc);
 
-  Solve(&map);
+  icfpc2019::IdfsOptions options;
+  options.ida = FLAGS_ida;
+  options.tt_log2 = FLAGS_tt_log2;
+  options.max_nodes = FLAGS_max_nodes;
+  options.num_threads = FLAGS_threads > 0
+      ? FLAGS_threads : std::thread::hardware_concurrency();
+  const auto result = icfpc2019::SolveByIdfs(&map, options);
+  if (!result.solved) {
+    LOG(WARNING) << "Gave up";
+    if (result.lower_bound != icfpc2019::IdaSearch::kInfinity)
+      std::cout << "Lower bound: " << result.lower_bound << std::endl;
+    return 0;
+  }
+  for (const auto& inst : result.program)
+    std::cout << inst;
+  std::cout << std::endl;
 }
@@ -0,0 +1,99 @@
+#ifndef LAYOUT_H_
+#define LAYOUT_H_
+
+#include <cstddef>
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Layouts of the cell grid of a Map in memory. A layout maps each cell to a
+// slot of a flat array, and groups the slots into equal, contiguous chunks,
+// which are the unit of copy-on-write of Map::Snapshot. There may be more
+// slots than cells; the extra ones are never addressed by a Point.
+//
+// The layout is chosen at compile time by CellLayout below.
+
+// Plain row-major order. A chunk is a row.
+class RowMajorLayout {
+ public:
+  static constexpr bool kRowMajor = true;
+
+  RowMajorLayout() = default;
+  RowMajorLayout(int width, int height) : width_(width), height_(height) {}
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  std::size_t size() const { return width_ * height_; }
+  std::size_t Slot(int x, int y) const { return y * width_ + x; }
+  Point PointOf(std::size_t slot) const {
+    return Point{static_cast<int>(slot % width_),
+                 static_cast<int>(slot / width_)};
+  }
+
+  std::size_t chunk_size() const { return width_; }
+  std::size_t num_chunks() const { return height_; }
+  std::size_t Chunk(std::size_t slot) const { return slot / width_; }
+
+ private:
+  std::size_t width_ = 0;
+  std::size_t height_ = 0;
+};
+
+// Square tiles of 2^kLog2 x 2^kLog2 cells, row-major within a tile and
+// across tiles, so that the cells around a wrapper share a few cache lines
+// whichever way it moves. The grid is padded up to whole tiles. A chunk is
+// a tile.
+template <int kLog2>
+class TiledLayout {
+ public:
+  static constexpr bool kRowMajor = false;
+  static constexpr int kSide = 1 << kLog2;
+
+  TiledLayout() = default;
+  TiledLayout(int width, int height)
+      : width_(width), height_(height),
+        tiles_per_row_((width + kSide - 1) >> kLog2),
+        tiles_per_column_((height + kSide - 1) >> kLog2) {}
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  std::size_t size() const { return num_chunks() << (2 * kLog2); }
+  std::size_t Slot(int x, int y) const {
+    const std::size_t tile = (y >> kLog2) * tiles_per_row_ + (x >> kLog2);
+    return tile << (2 * kLog2) | (y & (kSide - 1)) << kLog2 |
+        (x & (kSide - 1));
+  }
+  Point PointOf(std::size_t slot) const {
+    const std::size_t tile = slot >> (2 * kLog2);
+    const int offset = slot & ((1 << (2 * kLog2)) - 1);
+    return Point{
+      static_cast<int>(tile % tiles_per_row_) << kLog2 |
+          (offset & (kSide - 1)),
+      static_cast<int>(tile / tiles_per_row_) << kLog2 | offset >> kLog2,
+    };
+  }
+
+  std::size_t chunk_size() const { return 1 << (2 * kLog2); }
+  std::size_t num_chunks() const { return tiles_per_row_ * tiles_per_column_; }
+  std::size_t Chunk(std::size_t slot) const { return slot >> (2 * kLog2); }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  std::size_t tiles_per_row_ = 0;
+  std::size_t tiles_per_column_ = 0;
+};
+
+// Build with --config=tiled (i.e. -DPSH_TILED_LAYOUT) for 8x8 tiles.
+#ifdef PSH_TILED_LAYOUT
+using CellLayout = TiledLayout<3>;
+#else
+using CellLayout = RowMajorLayout;
+#endif
+
+}  // namespace icfpc2019
+
+#endif  // LAYOUT_H_
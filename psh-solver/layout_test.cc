@@ -0,0 +1,48 @@
+#include "layout.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace icfpc2019 {
+namespace {
+
+template <typename Layout>
+void ExpectConsistent(int width, int height) {
+  const Layout layout(width, height);
+  std::vector<int> used(layout.size());
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const auto slot = layout.Slot(x, y);
+      ASSERT_LT(slot, layout.size()) << x << " " << y;
+      EXPECT_EQ(0, used[slot]++) << x << " " << y;
+      EXPECT_EQ((Point{x, y}), layout.PointOf(slot));
+      EXPECT_LT(layout.Chunk(slot), layout.num_chunks());
+      EXPECT_EQ(layout.Chunk(slot), slot / layout.chunk_size());
+    }
+  }
+  EXPECT_EQ(layout.size(), layout.num_chunks() * layout.chunk_size());
+}
+
+TEST(LayoutTest, RowMajor) {
+  ExpectConsistent<RowMajorLayout>(1, 1);
+  ExpectConsistent<RowMajorLayout>(37, 12);
+  EXPECT_EQ(5 * 7 + 3, RowMajorLayout(7, 9).Slot(3, 5));
+}
+
+TEST(LayoutTest, Tiled) {
+  ExpectConsistent<TiledLayout<3>>(1, 1);
+  ExpectConsistent<TiledLayout<3>>(37, 12);
+  ExpectConsistent<TiledLayout<3>>(64, 16);
+  ExpectConsistent<TiledLayout<2>>(9, 30);
+
+  // Vertical neighbors within a tile are one row of the tile apart.
+  const TiledLayout<3> layout(400, 400);
+  EXPECT_EQ(layout.Slot(10, 10) + 8, layout.Slot(10, 11));
+  EXPECT_EQ(layout.Chunk(layout.Slot(8, 8)),
+            layout.Chunk(layout.Slot(15, 15)));
+  EXPECT_NE(layout.Chunk(layout.Slot(8, 8)), layout.Chunk(layout.Slot(16, 8)));
+}
+
+}  // namespace
+}  // namespace icfpc2019
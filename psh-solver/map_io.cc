@@ -0,0 +1,386 @@
+// Binary serialization of Map.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include "glog/logging.h"
+
+#include "mapped_file.h"
+#include "simulator.h"
+
+namespace icfpc2019 {
+namespace {
+
+constexpr char kMagic[8] = {'P', 'S', 'H', 'M', 'A', 'P', '\0', '\0'};
+constexpr std::uint32_t kVersion = 2;
+// Flags in the header.
+constexpr std::uint32_t kWithUndoLog = 1;
+
+class ImageWriter {
+ public:
+  template <typename T>
+  void Put(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "Not plain data");
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // With the number of elements.
+  template <typename T>
+  void PutVector(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value, "Not plain data");
+    Put<std::uint32_t>(values.size());
+    data_.append(reinterpret_cast<const char*>(values.data()),
+                 sizeof(T) * values.size());
+  }
+
+  std::string& data() { return data_; }
+
+ private:
+  std::string data_;
+};
+
+class ImageReader {
+ public:
+  explicit ImageReader(absl::string_view data) : data_(data) {}
+
+  bool done() const { return data_.empty(); }
+
+  // Reads a number of elements to follow, each at least a byte.
+  std::size_t GetCount() {
+    const std::size_t count = Get<std::uint32_t>();
+    CHECK_LE(count, data_.size()) << "Truncated map image";
+    return count;
+  }
+
+  absl::string_view GetBytes(std::size_t size) {
+    CHECK_LE(size, data_.size()) << "Truncated map image";
+    const auto bytes = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return bytes;
+  }
+
+  template <typename T>
+  T Get() {
+    static_assert(std::is_trivially_copyable<T>::value, "Not plain data");
+    CHECK_LE(sizeof(T), data_.size()) << "Truncated map image";
+    T value;
+    std::memcpy(&value, data_.data(), sizeof(T));
+    data_.remove_prefix(sizeof(T));
+    return value;
+  }
+
+  template <typename T>
+  std::vector<T> GetVector() {
+    static_assert(std::is_trivially_copyable<T>::value, "Not plain data");
+    const std::size_t size = Get<std::uint32_t>();
+    CHECK_LE(size, data_.size() / sizeof(T)) << "Truncated map image";
+    std::vector<T> values(size);
+    std::memcpy(values.data(), data_.data(), sizeof(T) * size);
+    data_.remove_prefix(sizeof(T) * size);
+    return values;
+  }
+
+ private:
+  absl::string_view data_;
+};
+
+// As set by F and L, including the turn they are used.
+constexpr int kMaxFastCount = 51;
+constexpr int kMaxDrillCount = 31;
+
+void CheckCell(Cell cell) {
+  CHECK_LE(static_cast<int>(cell), static_cast<int>(Cell::WALL))
+      << "Bad cell in map image";
+}
+
+void CheckBooster(Booster booster) {
+  CHECK_LE(static_cast<int>(booster), static_cast<int>(Booster::C))
+      << "Bad booster in map image";
+}
+
+}  // namespace
+
+std::string Map::Serialize(bool with_undo_log) const {
+  ImageWriter writer;
+  writer.data().append(kMagic, sizeof(kMagic));
+  writer.Put(kVersion);
+  writer.Put<std::uint32_t>(with_undo_log ? kWithUndoLog : 0);
+
+  // Terrain.
+  writer.Put<std::int32_t>(width_);
+  writer.Put<std::int32_t>(height_);
+  writer.Put(terrain_->start());
+  writer.PutVector(terrain_->cells());
+  writer.Put<std::uint32_t>(terrain_->boosters().size());
+  for (const auto& booster : terrain_->boosters()) {
+    writer.Put(booster.first);
+    writer.Put(booster.second);
+  }
+
+  // The grid is written in Index() order, whatever the CellLayout.
+  std::vector<Cell> cells(width_ * height_);
+  for (std::size_t y = 0; y < height_; ++y) {
+    for (std::size_t x = 0; x < width_; ++x)
+      cells[y * width_ + x] = map_[layout_.Slot(x, y)];
+  }
+  writer.PutVector(cells);
+  writer.PutVector(taken_);
+  writer.PutVector(booster_points_);
+  writer.PutVector(reset_points_);
+
+  writer.Put<std::uint32_t>(wrappers_.size());
+  for (const auto& wrapper : wrappers_) {
+    writer.Put(wrapper.point());
+    writer.PutVector(wrapper.manipulators());
+    writer.Put<std::int32_t>(wrapper.fast_count());
+    writer.Put<std::int32_t>(wrapper.drill_count());
+    writer.Put(wrapper.pending_booster());
+  }
+
+  writer.Put<std::int32_t>(num_steps_);
+  writer.Put<std::int32_t>(remaining_);
+  writer.Put<std::int32_t>(num_drilled_);
+  writer.Put(hash_);
+  writer.Put<std::int32_t>(collected_b_);
+  writer.Put<std::int32_t>(collected_f_);
+  writer.Put<std::int32_t>(collected_l_);
+  writer.Put<std::int32_t>(collected_r_);
+  writer.Put<std::int32_t>(collected_c_);
+
+  if (with_undo_log) {
+    writer.Put<std::uint64_t>(backlogs_.limit_);
+    const std::vector<BacklogEntry> entries(
+        backlogs_.entries_.begin() + backlogs_.first_,
+        backlogs_.entries_.end());
+    writer.PutVector(entries);
+    // Deltas hold slots of |layout_|, so convert them to Index().
+    const std::size_t cells_first =
+        entries.empty() ? 0 : entries.front().cells_begin();
+    std::vector<Backlog::CellDelta> deltas;
+    deltas.reserve(backlogs_.cells_.size() - cells_first);
+    for (std::size_t i = cells_first; i < backlogs_.cells_.size(); ++i) {
+      const auto delta = backlogs_.cells_[i];
+      deltas.push_back(Backlog::MakeDelta(
+          Index(layout_.PointOf(Backlog::DeltaIndex(delta))),
+          Backlog::DeltaCell(delta)));
+    }
+    writer.PutVector(deltas);
+
+    writer.Put<std::uint32_t>(step_logs_.size());
+    for (const auto& log : step_logs_) {
+      writer.Put<std::int32_t>(log.num_actions);
+      writer.Put<std::int32_t>(log.flushed_begin);
+      writer.Put<std::int32_t>(log.end);
+    }
+    writer.Put<std::uint32_t>(flushed_boosters_.size());
+    for (const auto& flushed : flushed_boosters_) {
+      writer.Put<std::int32_t>(flushed.first);
+      writer.Put(flushed.second);
+    }
+  }
+  return std::move(writer.data());
+}
+
+Map Map::Deserialize(absl::string_view image) {
+  ImageReader reader(image);
+  CHECK(reader.GetBytes(sizeof(kMagic)) ==
+        absl::string_view(kMagic, sizeof(kMagic))) << "Not a map image";
+  CHECK_EQ(reader.Get<std::uint32_t>(), kVersion)
+      << "Unknown map image version";
+  const auto flags = reader.Get<std::uint32_t>();
+
+  const int width = reader.Get<std::int32_t>();
+  const int height = reader.Get<std::int32_t>();
+  CHECK(width > 0 && height > 0) << "Bad map size";
+  const auto start = reader.Get<Point>();
+  auto terrain_cells = reader.GetVector<Cell>();
+  for (const auto cell : terrain_cells) {
+    CheckCell(cell);
+  }
+  std::vector<std::pair<Point, Booster>> boosters(reader.GetCount());
+  for (auto& booster : boosters) {
+    booster.first = reader.Get<Point>();
+    booster.second = reader.Get<Booster>();
+    CheckBooster(booster.second);
+  }
+  Map map(std::make_shared<const Terrain>(
+      width, height, start, std::move(terrain_cells), boosters));
+  const auto& terrain = *map.terrain_;
+
+  // remaining_ and num_drilled_ are recounted from the cells, rather than
+  // trusted.
+  const auto cells = reader.GetVector<Cell>();
+  CHECK_EQ(cells.size(), map.width_ * map.height_);
+  int remaining = 0;
+  int num_drilled = 0;
+  for (std::size_t i = 0; i < cells.size(); ++i) {
+    CheckCell(cells[i]);
+    const bool wall = terrain.cells()[i] == Cell::WALL;
+    CHECK(wall || cells[i] != Cell::WALL) << "Wall out of nowhere";
+    remaining += cells[i] == Cell::EMPTY;
+    num_drilled += wall && cells[i] != Cell::WALL;
+  }
+  for (std::size_t y = 0; y < map.height_; ++y) {
+    for (std::size_t x = 0; x < map.width_; ++x)
+      map.map_[map.layout_.Slot(x, y)] = cells[y * map.width_ + x];
+  }
+  map.taken_ = reader.GetVector<std::uint8_t>();
+  CHECK_EQ(map.taken_.size(), boosters.size());
+  std::size_t num_left = 0;
+  for (const auto taken : map.taken_) {
+    CHECK_LE(taken, 1) << "Bad booster state";
+    num_left += !taken;
+  }
+  map.booster_points_ = reader.GetVector<Point>();
+  CHECK_EQ(map.booster_points_.size(), num_left);
+  for (const auto& p : map.booster_points_) {
+    CHECK(map.InMap(p)) << "Booster " << p << " is out of the map";
+    const auto id = terrain.booster_id(map.Index(p));
+    CHECK(id != Terrain::kNoBooster && !map.taken_[id])
+        << "No booster left at " << p;
+  }
+  map.reset_points_ = reader.GetVector<Point>();
+  for (const auto& p : map.reset_points_) {
+    CHECK(map.InMap(p)) << "Reset point " << p << " is out of the map";
+    CHECK(!map.IsResetPoint(p)) << "Two reset points at " << p;
+    map.SetResetPoint(p, true);
+  }
+
+  map.wrappers_.clear();
+  const std::size_t num_wrappers = reader.GetCount();
+  CHECK_GT(num_wrappers, 0u) << "No wrapper";
+  for (std::size_t i = 0; i < num_wrappers; ++i) {
+    Wrapper wrapper(reader.Get<Point>());
+    CHECK(map.InMap(wrapper.point()))
+        << "Wrapper " << wrapper.point() << " is out of the map";
+    while (!wrapper.manipulators().empty()) {
+      wrapper.RemoveManipulator();
+    }
+    for (const auto& manip : reader.GetVector<Point>()) {
+      wrapper.AddManipulator(manip);
+    }
+    const int fast_count = reader.Get<std::int32_t>();
+    const int drill_count = reader.Get<std::int32_t>();
+    CHECK(0 <= fast_count && fast_count <= kMaxFastCount) << "Bad fast count";
+    CHECK(0 <= drill_count && drill_count <= kMaxDrillCount)
+        << "Bad drill count";
+    wrapper.set_fast_count(fast_count);
+    wrapper.set_drill_count(drill_count);
+    wrapper.set_pending_booster(reader.Get<Booster>());
+    CheckBooster(wrapper.pending_booster());
+    map.wrappers_.push_back(std::move(wrapper));
+  }
+
+  map.num_steps_ = reader.Get<std::int32_t>();
+  CHECK_GE(map.num_steps_, 0) << "Bad number of steps";
+  map.remaining_ = reader.Get<std::int32_t>();
+  CHECK_EQ(map.remaining_, remaining) << "Inconsistent remaining cells";
+  map.num_drilled_ = reader.Get<std::int32_t>();
+  CHECK_EQ(map.num_drilled_, num_drilled) << "Inconsistent drilled cells";
+  map.hash_ = reader.Get<std::uint64_t>();
+  for (auto* collected : {&map.collected_b_, &map.collected_f_,
+                          &map.collected_l_, &map.collected_r_,
+                          &map.collected_c_}) {
+    *collected = reader.Get<std::int32_t>();
+    CHECK_GE(*collected, 0) << "Bad booster count";
+  }
+
+  map.backlogs_.Clear();
+  if (flags & kWithUndoLog) {
+    map.backlogs_.set_limit(reader.Get<std::uint64_t>());
+    auto entries = reader.GetVector<BacklogEntry>();
+    const auto deltas = reader.GetVector<Backlog::CellDelta>();
+    CHECK_LE(entries.size(), static_cast<std::size_t>(map.num_steps_))
+        << "More undo entries than steps";
+    // Undo() relies on all of these, so the log is checked as thoroughly
+    // as the state.
+    const std::size_t cells_first =
+        entries.empty() ? 0 : entries.front().cells_begin();
+    std::size_t cells_begin = 0;
+    for (auto& entry : entries) {
+      CHECK_LT(entry.wrapper_index(), num_wrappers)
+          << "Undo entry of an unknown wrapper";
+      CHECK_LE(static_cast<int>(entry.action()),
+               static_cast<int>(BacklogEntry::Action::C))
+          << "Bad undo action";
+      CHECK_LE(entry.fast_count(), kMaxFastCount) << "Bad fast count";
+      CHECK_LE(entry.drill_count(), kMaxDrillCount) << "Bad drill count";
+      CheckBooster(entry.pending_booster());
+      CheckBooster(entry.first_booster());
+      CheckBooster(entry.second_booster());
+      CHECK_GE(entry.cells_begin(), cells_first);
+      entry.set_cells_begin(entry.cells_begin() - cells_first);
+      CHECK_GE(entry.cells_begin(), cells_begin)
+          << "Undo entries out of order";
+      CHECK_LE(entry.cells_begin(), deltas.size());
+      cells_begin = entry.cells_begin();
+    }
+    map.backlogs_.entries_ = std::move(entries);
+    map.backlogs_.cells_.clear();
+    for (const auto delta : deltas) {
+      const auto index = Backlog::DeltaIndex(delta);
+      CHECK_LT(index, cells.size());
+      CheckCell(Backlog::DeltaCell(delta));
+      map.backlogs_.cells_.push_back(Backlog::MakeDelta(
+          map.layout_.Slot(index % map.width_, index / map.width_),
+          Backlog::DeltaCell(delta)));
+    }
+
+    // Steps cover disjoint runs of actions, in order. Those beyond the undo
+    // window (only with a limit) are refused by UndoStep().
+    const int window_begin = map.num_steps_ - map.backlogs_.size();
+    map.step_logs_.resize(reader.GetCount());
+    int prev_end = 0;
+    int prev_flushed = 0;
+    for (auto& log : map.step_logs_) {
+      log.num_actions = reader.Get<std::int32_t>();
+      log.flushed_begin = reader.Get<std::int32_t>();
+      log.end = reader.Get<std::int32_t>();
+      CHECK(0 <= log.num_actions && prev_end <= log.end - log.num_actions &&
+            log.end <= map.num_steps_) << "Bad step log";
+      CHECK(map.backlogs_.limit() > 0 ||
+            window_begin <= log.end - log.num_actions)
+          << "Step beyond the undo log";
+      CHECK_LE(prev_flushed, log.flushed_begin)
+          << "Flushed boosters out of order";
+      prev_end = log.end;
+      prev_flushed = log.flushed_begin;
+    }
+    map.flushed_boosters_.resize(reader.GetCount());
+    CHECK_LE(prev_flushed, map.flushed_boosters_.size())
+        << "Step of unknown flushed boosters";
+    for (auto& flushed : map.flushed_boosters_) {
+      flushed.first = reader.Get<std::int32_t>();
+      flushed.second = reader.Get<Booster>();
+      CHECK(0 <= flushed.first &&
+            static_cast<std::size_t>(flushed.first) < num_wrappers)
+          << "Booster flushed by an unknown wrapper";
+      CheckBooster(flushed.second);
+      CHECK(flushed.second != Booster::X) << "Flushed nothing";
+    }
+  }
+  CHECK(reader.done()) << "Trailing data in map image";
+  return map;
+}
+
+void Map::Save(const std::string& path, bool with_undo_log) const {
+  const std::string image = Serialize(with_undo_log);
+  const std::string temp = path + ".tmp";
+  const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  PCHECK(fd >= 0) << "Failed to create " << temp;
+  PCHECK(write(fd, image.data(), image.size()) ==
+         static_cast<ssize_t>(image.size())) << "Failed to write " << temp;
+  PCHECK(close(fd) == 0) << temp;
+  PCHECK(std::rename(temp.c_str(), path.c_str()) == 0)
+      << "Failed to rename " << temp << " to " << path;
+}
+
+Map Map::Load(const std::string& path) {
+  return Deserialize(MappedFile(path).contents());
+}
+
+}  // namespace icfpc2019
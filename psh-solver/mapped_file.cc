@@ -0,0 +1,78 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+
+MappedFile::MappedFile(const std::string& path) {
+  PCHECK(Open(path)) << "Failed to open " << path;
+}
+
+absl::optional<MappedFile> MappedFile::TryOpen(const std::string& path) {
+  MappedFile file;
+  if (!file.Open(path))
+    return absl::nullopt;
+  return absl::make_optional(std::move(file));
+}
+
+bool MappedFile::Open(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if (ok) {
+    size_ = st.st_size;
+    // mmap() refuses empty mappings, and an empty file needs none.
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      ok = data != MAP_FAILED;
+      if (ok) {
+        // Parsers read the contents once from the front.
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data);
+      } else {
+        size_ = 0;
+      }
+    }
+  }
+  const int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return ok;
+}
+
+MappedFile::~MappedFile() {
+  Unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Unmap();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+void MappedFile::Unmap() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+}  // namespace icfpc2019
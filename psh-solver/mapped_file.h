@@ -0,0 +1,44 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace icfpc2019 {
+
+// Read-only memory mapping of a whole file, so that parsers can work on it
+// in place instead of reading it into a std::string first.
+class MappedFile {
+ public:
+  // Dies if |path| cannot be opened.
+  explicit MappedFile(const std::string& path);
+  // Returns nullopt, leaving errno set, if |path| cannot be opened.
+  static absl::optional<MappedFile> TryOpen(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  absl::string_view contents() const {
+    return absl::string_view(data_, size_);
+  }
+
+ private:
+  MappedFile() = default;
+
+  // Returns false, leaving errno set, on failure.
+  bool Open(const std::string& path);
+  void Unmap();
+
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+}  // namespace icfpc2019
+
+#endif  // MAPPED_FILE_H_
@@ -0,0 +1,66 @@
+#include "packed_program.h"
+
+#include <iostream>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+
+PackedProgram::PackedProgram(const Program& program) {
+  codes_.reserve((program.size() + 1) / 2);
+  for (const auto& inst : program) {
+    push_back(inst);
+  }
+}
+
+void PackedProgram::push_back(const Instruction& inst) {
+  const auto code = static_cast<std::uint8_t>(inst.type);
+  DCHECK_LT(code, 16);
+  if (size_ % 2 == 0) {
+    codes_.push_back(code);
+  } else {
+    codes_.back() |= code << 4;
+  }
+  if (HasArg(inst.type))
+    args_.push_back(inst.arg);
+  ++size_;
+}
+
+void PackedProgram::pop_back() {
+  CHECK_GT(size_, 0u);
+  --size_;
+  if (HasArg(type(size_)))
+    args_.pop_back();
+  if (size_ % 2 == 0) {
+    codes_.pop_back();
+  } else {
+    codes_.back() &= 0xF;
+  }
+}
+
+Instruction PackedProgram::back() const {
+  CHECK_GT(size_, 0u);
+  Instruction inst{type(size_ - 1)};
+  if (HasArg(inst.type))
+    inst.arg = args_.back();
+  return inst;
+}
+
+void PackedProgram::clear() {
+  codes_.clear();
+  args_.clear();
+  size_ = 0;
+}
+
+Program PackedProgram::Unpack() const {
+  return Program(begin(), end());
+}
+
+std::ostream& operator<<(std::ostream& os, const PackedProgram& program) {
+  for (const auto& inst : program) {
+    os << inst;
+  }
+  return os;
+}
+
+}  // namespace icfpc2019
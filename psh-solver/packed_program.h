@@ -0,0 +1,113 @@
+#ifndef PACKED_PROGRAM_H_
+#define PACKED_PROGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <iterator>
+#include <vector>
+
+#include "simulator.h"
+
+namespace icfpc2019 {
+
+// Compact Program: a 4-bit opcode per instruction, two per byte, and the
+// arguments of B and T in a side table in instruction order. A move costs
+// half a byte instead of sizeof(Instruction) (12 bytes), which matters
+// when keeping many candidate solutions or move histories in memory.
+//
+// Supports appending and removing at the end, and forward iteration.
+class PackedProgram {
+ public:
+  class const_iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Instruction;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Instruction*;
+    using reference = Instruction;
+
+    Instruction operator*() const {
+      Instruction inst{program_->type(index_)};
+      if (HasArg(inst.type))
+        inst.arg = program_->args_[arg_index_];
+      return inst;
+    }
+    const_iterator& operator++() {
+      if (HasArg(program_->type(index_)))
+        ++arg_index_;
+      ++index_;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      auto result = *this;
+      ++*this;
+      return result;
+    }
+    bool operator==(const const_iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    friend class PackedProgram;
+    const_iterator(const PackedProgram* program, std::size_t index,
+                   std::size_t arg_index)
+        : program_(program), index_(index), arg_index_(arg_index) {}
+
+    const PackedProgram* program_;
+    std::size_t index_;
+    std::size_t arg_index_;
+  };
+
+  PackedProgram() = default;
+  explicit PackedProgram(const Program& program);
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  void push_back(const Instruction& inst);
+  // Must not be empty().
+  void pop_back();
+  Instruction back() const;
+  void clear();
+
+  const_iterator begin() const { return const_iterator(this, 0, 0); }
+  const_iterator end() const {
+    return const_iterator(this, size_, args_.size());
+  }
+
+  Program Unpack() const;
+
+  friend bool operator==(const PackedProgram& lhs, const PackedProgram& rhs) {
+    return lhs.size_ == rhs.size_ && lhs.codes_ == rhs.codes_ &&
+        lhs.args_ == rhs.args_;
+  }
+  friend bool operator!=(const PackedProgram& lhs, const PackedProgram& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  static bool HasArg(Instruction::Type type) {
+    return type == Instruction::Type::B || type == Instruction::Type::T;
+  }
+  Instruction::Type type(std::size_t i) const {
+    return static_cast<Instruction::Type>(codes_[i >> 1] >> (i & 1) * 4 & 0xF);
+  }
+
+  // Instruction i is in the low nibble of codes_[i / 2] if i is even, the
+  // high one otherwise. Unused nibbles are zero, so that equal programs
+  // have equal bytes.
+  std::vector<std::uint8_t> codes_;
+  std::vector<Point> args_;
+  std::size_t size_ = 0;
+};
+
+// Same format as for Program, so ParseSolution() reads it back.
+std::ostream& operator<<(std::ostream& os, const PackedProgram& program);
+
+}  // namespace icfpc2019
+
+#endif  // PACKED_PROGRAM_H_
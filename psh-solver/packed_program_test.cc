@@ -0,0 +1,71 @@
+#include "packed_program.h"
+
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace icfpc2019 {
+namespace {
+
+Program RandomProgram(std::mt19937* rng, int size) {
+  Program program;
+  for (int i = 0; i < size; ++i) {
+    Instruction inst{static_cast<Instruction::Type>((*rng)() % 13)};
+    if (inst.type == Instruction::Type::B)
+      inst.arg = Point{static_cast<int>((*rng)() % 7) - 3,
+                       static_cast<int>((*rng)() % 7) - 3};
+    if (inst.type == Instruction::Type::T)
+      inst.arg = Point{static_cast<int>((*rng)() % 400),
+                       static_cast<int>((*rng)() % 400)};
+    program.push_back(inst);
+  }
+  return program;
+}
+
+std::string ToString(const Program& program) {
+  std::ostringstream os;
+  os << program;
+  return os.str();
+}
+
+TEST(PackedProgramTest, RoundTrip) {
+  std::mt19937 rng(1);
+  for (int size : {0, 1, 2, 3, 100, 1001}) {
+    const auto program = RandomProgram(&rng, size);
+    const PackedProgram packed(program);
+    EXPECT_EQ(program.size(), packed.size());
+    EXPECT_EQ(ToString(program), ToString(packed.Unpack()));
+
+    std::ostringstream os;
+    os << packed;
+    EXPECT_EQ(ToString(program), os.str());
+    const auto parsed = ParseSolution(os.str());
+    ASSERT_EQ(1u, parsed.programs.size());
+    EXPECT_EQ(packed, PackedProgram(parsed.programs[0]));
+  }
+}
+
+TEST(PackedProgramTest, PushAndPop) {
+  std::mt19937 rng(2);
+  const auto program = RandomProgram(&rng, 300);
+  PackedProgram packed;
+  for (const auto& inst : program) {
+    packed.push_back(inst);
+    EXPECT_EQ(ToString({inst}), ToString({packed.back()}));
+  }
+  // Popping back to a prefix gives the same bytes as building it.
+  for (int size = 300; size > 0; size -= 7) {
+    while (static_cast<int>(packed.size()) > size)
+      packed.pop_back();
+    EXPECT_EQ(PackedProgram(Program(program.begin(), program.begin() + size)),
+              packed);
+  }
+  packed.clear();
+  EXPECT_TRUE(packed.empty());
+  EXPECT_EQ(packed.begin(), packed.end());
+}
+
+}  // namespace
+}  // namespace icfpc2019
@@ -0,0 +1,133 @@
+#include "raster.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+namespace {
+
+struct VerticalEdge {
+  int x;
+  int y0;  // y0 < y1.
+  int y1;
+};
+
+struct HorizontalEdge {
+  int y;
+  int x0;  // x0 < x1.
+  int x1;
+};
+
+// Edges of a set of polygons, filled by the even-odd rule.
+class EdgeTable {
+ public:
+  EdgeTable(int width, int height) : width_(width), height_(height) {}
+
+  void AddPolygon(const std::vector<Point>& polygon);
+
+  // Sets the cells inside the polygons to |cell|.
+  void Fill(Cell cell, std::vector<Cell>* result);
+
+ private:
+  int width_;
+  int height_;
+  std::vector<VerticalEdge> verticals_;
+  std::vector<HorizontalEdge> horizontals_;
+};
+
+void EdgeTable::AddPolygon(const std::vector<Point>& polygon) {
+  CHECK_GE(polygon.size(), 4u) << "Polygon has too few vertices";
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    const auto& p1 = polygon[i];
+    const auto& p2 = polygon[(i + 1) % polygon.size()];
+    CHECK(0 <= p1.x && p1.x <= width_ && 0 <= p1.y && p1.y <= height_)
+        << "Vertex " << p1 << " is out of the map";
+    if (p1 == p2) {
+      // Repeated vertex. Harmless.
+    } else if (p1.x == p2.x) {
+      verticals_.push_back(
+          VerticalEdge{p1.x, std::min(p1.y, p2.y), std::max(p1.y, p2.y)});
+    } else if (p1.y == p2.y) {
+      horizontals_.push_back(
+          HorizontalEdge{p1.y, std::min(p1.x, p2.x), std::max(p1.x, p2.x)});
+    } else {
+      LOG(FATAL) << "Edge " << p1 << "-" << p2 << " is not axis-aligned";
+    }
+  }
+}
+
+void EdgeTable::Fill(Cell cell, std::vector<Cell>* result) {
+  std::sort(verticals_.begin(), verticals_.end(),
+            [](const VerticalEdge& lhs, const VerticalEdge& rhs) {
+              return lhs.y0 < rhs.y0;
+            });
+  std::sort(horizontals_.begin(), horizontals_.end(),
+            [](const HorizontalEdge& lhs, const HorizontalEdge& rhs) {
+              return lhs.y < rhs.y;
+            });
+  auto by_x = [](const VerticalEdge& lhs, const VerticalEdge& rhs) {
+    return lhs.x < rhs.x;
+  };
+
+  // Vertical edges crossing the current row, sorted by x.
+  std::vector<VerticalEdge> active;
+  std::size_t next_vertical = 0, next_horizontal = 0;
+  for (int y = 0; y < height_; ++y) {
+    active.erase(
+        std::remove_if(active.begin(), active.end(),
+                       [y](const VerticalEdge& e) { return e.y1 <= y; }),
+        active.end());
+
+    // Edges passing through the line y from below are exactly the active
+    // ones so far. A horizontal edge on the line must not cross them.
+    for (; next_horizontal < horizontals_.size() &&
+             horizontals_[next_horizontal].y == y; ++next_horizontal) {
+      const auto& h = horizontals_[next_horizontal];
+      auto iter = std::upper_bound(
+          active.begin(), active.end(), VerticalEdge{h.x0, 0, 0}, by_x);
+      if (iter != active.end() && iter->x < h.x1) {
+        LOG(FATAL) << "Edge " << Point{h.x0, y} << "-" << Point{h.x1, y}
+                   << " crosses edge " << Point{iter->x, iter->y0} << "-"
+                   << Point{iter->x, iter->y1};
+      }
+    }
+
+    for (; next_vertical < verticals_.size() &&
+             verticals_[next_vertical].y0 == y; ++next_vertical) {
+      const auto& e = verticals_[next_vertical];
+      active.insert(
+          std::upper_bound(active.begin(), active.end(), e, by_x), e);
+    }
+
+    CHECK_EQ(active.size() % 2, 0u) << "Polygons are broken at row " << y;
+    auto* row = result->data() + static_cast<std::size_t>(y) * width_;
+    for (std::size_t i = 0; i < active.size(); i += 2) {
+      std::fill(row + active[i].x, row + active[i + 1].x, cell);
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<Cell> ConvertMap(
+    int width, int height,
+    const std::vector<Point>& map,
+    const std::vector<std::vector<Point>>& obstacles) {
+  std::vector<Cell> result(static_cast<std::size_t>(width) * height,
+                           Cell::WALL);
+
+  EdgeTable map_edges(width, height);
+  map_edges.AddPolygon(map);
+  map_edges.Fill(Cell::EMPTY, &result);
+
+  EdgeTable obstacle_edges(width, height);
+  for (const auto& obstacle : obstacles) {
+    obstacle_edges.AddPolygon(obstacle);
+  }
+  obstacle_edges.Fill(Cell::WALL, &result);
+
+  return result;
+}
+
+}  // namespace icfpc2019
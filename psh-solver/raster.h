@@ -0,0 +1,28 @@
+#ifndef RASTER_H_
+#define RASTER_H_
+
+#include <vector>
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Rasterizes the mine: cells inside the rectilinear polygon |map| are
+// EMPTY, unless they are inside one of |obstacles|. Everything else is
+// WALL. The result is in Map::Index() order.
+//
+// Vertical edges are bucketed by their lower end once, and swept upwards
+// with an active edge list sorted by x, so the cost is O(E log E + area)
+// rather than O(E) per row.
+//
+// Dies with a message if a polygon is malformed: a vertex outside the
+// width x height box, an edge which is not axis-aligned, or an edge
+// crossing another one (within a polygon or between obstacles).
+std::vector<Cell> ConvertMap(
+    int width, int height,
+    const std::vector<Point>& map,
+    const std::vector<std::vector<Point>>& obstacles);
+
+}  // namespace icfpc2019
+
+#endif  // RASTER_H_
@@ -0,0 +1,121 @@
+#include "raster.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace icfpc2019 {
+namespace {
+
+// Even-odd test of the center of the cell (x, y), by the vertical edges
+// to its left.
+bool Inside(const std::vector<Point>& polygon, int x, int y) {
+  bool inside = false;
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    const auto& p1 = polygon[i];
+    const auto& p2 = polygon[(i + 1) % polygon.size()];
+    if (p1.x == p2.x && p1.x <= x &&
+        std::min(p1.y, p2.y) <= y && y < std::max(p1.y, p2.y))
+      inside = !inside;
+  }
+  return inside;
+}
+
+TEST(RasterTest, MatchesPointInPolygon) {
+  constexpr int kWidth = 60;
+  constexpr int kHeight = 40;
+  std::mt19937 rng(1);
+  for (int iter = 0; iter < 20; ++iter) {
+    // A skyline, i.e. a random height per run of columns.
+    std::vector<Point> map = {{0, 0}, {kWidth, 0}};
+    for (int x = kWidth; x > 0;) {
+      const int next = std::max(0, x - 1 - static_cast<int>(rng() % 8));
+      const int top = kHeight / 2 + rng() % (kHeight / 2 + 1);
+      map.push_back({x, top});
+      map.push_back({next, top});
+      x = next;
+    }
+
+    // Disjoint rectangles, mostly inside the skyline.
+    std::vector<std::vector<Point>> obstacles;
+    std::vector<bool> used(kWidth * kHeight);
+    for (int i = 0; i < 15; ++i) {
+      const int x0 = rng() % (kWidth - 4), y0 = rng() % (kHeight / 2);
+      const int x1 = x0 + 1 + rng() % 4, y1 = y0 + 1 + rng() % 4;
+      bool overlaps = false;
+      for (int y = y0 - 1; y <= y1; ++y) {
+        for (int x = x0 - 1; x <= x1; ++x) {
+          overlaps = overlaps || (0 <= x && x < kWidth && 0 <= y &&
+                                  y < kHeight && used[y * kWidth + x]);
+        }
+      }
+      if (overlaps)
+        continue;
+      for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x)
+          used[y * kWidth + x] = true;
+      }
+      obstacles.push_back({{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}});
+    }
+
+    const auto cells = ConvertMap(kWidth, kHeight, map, obstacles);
+    for (int y = 0; y < kHeight; ++y) {
+      for (int x = 0; x < kWidth; ++x) {
+        bool empty = Inside(map, x, y);
+        for (const auto& obstacle : obstacles)
+          empty = empty && !Inside(obstacle, x, y);
+        ASSERT_EQ(empty ? Cell::EMPTY : Cell::WALL, cells[y * kWidth + x])
+            << iter << " " << x << " " << y;
+      }
+    }
+  }
+}
+
+TEST(RasterTest, Obstacles) {
+  // A U-shaped obstacle touching the map border, and a square in it.
+  const std::vector<Point> map = {{0, 0}, {6, 0}, {6, 5}, {0, 5}};
+  const std::vector<std::vector<Point>> obstacles = {
+    {{1, 0}, {5, 0}, {5, 4}, {4, 4}, {4, 1}, {2, 1}, {2, 4}, {1, 4}},
+    {{3, 2}, {4, 2}, {4, 3}, {3, 3}},
+  };
+  const char* kExpected[] = {
+    ".####.",
+    ".#..#.",
+    ".#.##.",
+    ".#..#.",
+    "......",
+  };
+  const auto cells = ConvertMap(6, 5, map, obstacles);
+  for (int y = 0; y < 5; ++y) {
+    for (int x = 0; x < 6; ++x) {
+      EXPECT_EQ(kExpected[y][x] == '.' ? Cell::EMPTY : Cell::WALL,
+                cells[y * 6 + x]) << x << " " << y;
+    }
+  }
+}
+
+TEST(RasterDeathTest, RejectsMalformedPolygons) {
+  const std::vector<Point> map = {{0, 0}, {8, 0}, {8, 8}, {0, 8}};
+  EXPECT_DEATH(ConvertMap(8, 8, {{0, 0}, {8, 0}, {8, 8}}, {}),
+               "too few vertices");
+  EXPECT_DEATH(ConvertMap(8, 8, {{0, 0}, {8, 0}, {8, 8}, {1, 8}}, {}),
+               "not axis-aligned");
+  EXPECT_DEATH(ConvertMap(8, 8, map, {{{1, 1}, {9, 1}, {9, 2}, {1, 2}}}),
+               "out of the map");
+  // Figure eight.
+  EXPECT_DEATH(
+      ConvertMap(8, 8, map,
+                 {{{0, 0}, {3, 0}, {3, 3}, {1, 3}, {1, 1}, {4, 1}, {4, 4},
+                   {0, 4}}}),
+      "crosses");
+  // Two overlapping obstacles.
+  EXPECT_DEATH(
+      ConvertMap(8, 8, map,
+                 {{{1, 1}, {4, 1}, {4, 4}, {1, 4}},
+                  {{2, 2}, {6, 2}, {6, 3}, {2, 3}}}),
+      "crosses");
+}
+
+}  // namespace
+}  // namespace icfpc2019
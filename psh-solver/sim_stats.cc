@@ -0,0 +1,150 @@
+#include "sim_stats.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gflags/gflags.h"
+
+DEFINE_string(sim_stats, "",
+              "Writes the simulator stats as JSON to this file at exit "
+              "('-' for stderr). Needs a build with --config=stats.");
+
+namespace icfpc2019 {
+namespace {
+
+#ifdef PSH_SIM_STATS
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+#ifdef PSH_SIM_TIMERS
+constexpr bool kTimers = true;
+#else
+constexpr bool kTimers = false;
+#endif
+
+// In the order of Map::RunResult.
+constexpr const char* kRunResultNames[SimStats::kNumRunResults] = {
+  "SUCCESS", "NO_WRAPPER", "OUT_OF_MAP", "WALL", "NO_BOOSTER",
+  "BAD_MANIPULATOR_POSITION", "BAD_TELEPORT_POSITION",
+  "UNKNOWN_TELEPORT_POSITION", "BAD_CLONE_POSITION", "UNKNOWN_INSTRUCTION",
+};
+
+constexpr const char* kTimerNames[SimStats::NUM_TIMERS] = {
+  "fill", "visible", "run", "undo",
+};
+
+std::mutex& RegistryMutex() {
+  static auto* mutex = new std::mutex;
+  return *mutex;
+}
+
+// Never freed, so that stats outlive their threads.
+std::vector<SimStats*>& Registry() {
+  static auto* registry = new std::vector<SimStats*>;
+  return *registry;
+}
+
+SimStats* NewThreadSimStats() {
+  auto* stats = new SimStats;
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  Registry().push_back(stats);
+  return stats;
+}
+
+void DumpSimStats() {
+  if (FLAGS_sim_stats.empty())
+    return;
+  const std::string json = SimStatsJson();
+  if (FLAGS_sim_stats == "-") {
+    std::fputs(json.c_str(), stderr);
+    return;
+  }
+  std::FILE* file = std::fopen(FLAGS_sim_stats.c_str(), "w");
+  if (!file || std::fputs(json.c_str(), file) < 0 || std::fclose(file) != 0)
+    std::perror(FLAGS_sim_stats.c_str());
+}
+
+const int kDumpRegistered = std::atexit(DumpSimStats);
+
+}  // namespace
+
+void SimStats::Merge(const SimStats& other) {
+  run_calls += other.run_calls;
+  dry_run_calls += other.dry_run_calls;
+  undo_calls += other.undo_calls;
+  fill_calls += other.fill_calls;
+  visible_calls += other.visible_calls;
+  visible_slow_calls += other.visible_slow_calls;
+  cells_examined += other.cells_examined;
+  cells_filled += other.cells_filled;
+  cells_unfilled += other.cells_unfilled;
+  for (int i = 0; i < kNumRunResults; ++i) {
+    run_results[i] += other.run_results[i];
+  }
+  if (peak_undo_depth < other.peak_undo_depth)
+    peak_undo_depth = other.peak_undo_depth;
+  for (int i = 0; i < NUM_TIMERS; ++i) {
+    cycles[i] += other.cycles[i];
+  }
+}
+
+std::string SimStats::ToJson() const {
+  std::string json = absl::StrCat(
+      "{\"calls\": {\"run\": ", run_calls,
+      ", \"dry_run\": ", dry_run_calls,
+      ", \"undo\": ", undo_calls,
+      ", \"fill\": ", fill_calls,
+      ", \"visible\": ", visible_calls,
+      ", \"visible_slow\": ", visible_slow_calls,
+      "}, \"cells\": {\"examined\": ", cells_examined,
+      ", \"filled\": ", cells_filled,
+      ", \"unfilled\": ", cells_unfilled,
+      "}, \"run_results\": {");
+  for (int i = 0; i < kNumRunResults; ++i) {
+    absl::StrAppend(&json, i ? ", " : "", "\"", kRunResultNames[i], "\": ",
+                    run_results[i]);
+  }
+  absl::StrAppend(&json, "}, \"peak_undo_depth\": ", peak_undo_depth,
+                  ", \"cycles\": {");
+  for (int i = 0; i < NUM_TIMERS; ++i) {
+    absl::StrAppend(&json, i ? ", " : "", "\"", kTimerNames[i], "\": ",
+                    cycles[i]);
+  }
+  json += "}}";
+  return json;
+}
+
+SimStats& ThreadSimStats() {
+  thread_local SimStats* const stats = NewThreadSimStats();
+  return *stats;
+}
+
+std::string SimStatsJson() {
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  SimStats total;
+  std::string threads;
+  for (const auto* stats : Registry()) {
+    total.Merge(*stats);
+    absl::StrAppend(&threads, threads.empty() ? "\n    " : ",\n    ",
+                    stats->ToJson());
+  }
+  return absl::StrCat("{\n  \"enabled\": ", kEnabled ? "true" : "false",
+                      ",\n  \"timers\": ", kTimers ? "true" : "false",
+                      ",\n  \"total\": ", total.ToJson(),
+                      ",\n  \"threads\": [", threads,
+                      threads.empty() ? "]" : "\n  ]", "\n}\n");
+}
+
+void ResetSimStats() {
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  for (auto* stats : Registry()) {
+    *stats = SimStats();
+  }
+}
+
+}  // namespace icfpc2019
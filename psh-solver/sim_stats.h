@@ -0,0 +1,119 @@
+#ifndef SIM_STATS_H_
+#define SIM_STATS_H_
+
+#include <cstdint>
+#include <string>
+
+#if defined(PSH_SIM_TIMERS) && !defined(PSH_SIM_STATS)
+#define PSH_SIM_STATS
+#endif
+
+#if defined(PSH_SIM_TIMERS) && defined(__x86_64__)
+#include <x86intrin.h>
+#elif defined(PSH_SIM_TIMERS)
+#include <chrono>
+#endif
+
+namespace icfpc2019 {
+
+// Counters of the simulator hot paths, for telling where a slow solve spends
+// its time. Compiled in only with --config=stats (-DPSH_SIM_STATS), and
+// cycle timers additionally with --config=stats_timers (-DPSH_SIM_TIMERS);
+// otherwise the SIM_STATS_* macros below expand to nothing.
+//
+// Each thread counts into its own SimStats, which outlives the thread. With
+// --sim_stats=<path> ('-' for stderr) all of them are written as JSON at
+// exit.
+struct SimStats {
+  // Map::RunResult, which is checked in simulator.cc.
+  static constexpr int kNumRunResults = 10;
+
+  enum Timer { FILL, VISIBLE, RUN, UNDO, NUM_TIMERS };
+
+  std::uint64_t run_calls = 0;
+  std::uint64_t dry_run_calls = 0;
+  std::uint64_t undo_calls = 0;
+  std::uint64_t fill_calls = 0;
+  std::uint64_t visible_calls = 0;
+  // Visible() calls not decided by the wall window.
+  std::uint64_t visible_slow_calls = 0;
+  // Cells looked at by Fill(): the wrapper and its manipulators.
+  std::uint64_t cells_examined = 0;
+  // Cells changed by Fill() and Unfill().
+  std::uint64_t cells_filled = 0;
+  std::uint64_t cells_unfilled = 0;
+  std::uint64_t run_results[kNumRunResults] = {};
+  std::uint64_t peak_undo_depth = 0;
+  // Inclusive, e.g. RUN includes FILL. Zero without PSH_SIM_TIMERS.
+  std::uint64_t cycles[NUM_TIMERS] = {};
+
+  void Merge(const SimStats& other);
+  std::string ToJson() const;
+};
+
+// Stats of the calling thread.
+SimStats& ThreadSimStats();
+
+// All threads' stats as JSON: their sum, and each of them. Other threads
+// should be done counting.
+std::string SimStatsJson();
+
+// Zeroes the stats of all threads.
+void ResetSimStats();
+
+#ifdef PSH_SIM_TIMERS
+inline std::uint64_t ReadCycleCounter() {
+#ifdef __x86_64__
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Adds the cycles of its lifetime to ThreadSimStats().cycles[timer].
+class ScopedCycleTimer {
+ public:
+  explicit ScopedCycleTimer(SimStats::Timer timer)
+      : timer_(timer), begin_(ReadCycleCounter()) {}
+  ~ScopedCycleTimer() {
+    ThreadSimStats().cycles[timer_] += ReadCycleCounter() - begin_;
+  }
+
+  ScopedCycleTimer(const ScopedCycleTimer&) = delete;
+  ScopedCycleTimer& operator=(const ScopedCycleTimer&) = delete;
+
+ private:
+  const SimStats::Timer timer_;
+  const std::uint64_t begin_;
+};
+#endif
+
+}  // namespace icfpc2019
+
+#ifdef PSH_SIM_STATS
+#define SIM_STATS_ADD(field, n) \
+  (::icfpc2019::ThreadSimStats().field += (n))
+#define SIM_STATS_MAX(field, n)                                    \
+  do {                                                             \
+    auto& sim_stats_field = ::icfpc2019::ThreadSimStats().field;  \
+    if (sim_stats_field < static_cast<std::uint64_t>(n))           \
+      sim_stats_field = (n);                                       \
+  } while (false)
+#else
+#define SIM_STATS_ADD(field, n) ((void)0)
+#define SIM_STATS_MAX(field, n) ((void)0)
+#endif
+#define SIM_STATS_INC(field) SIM_STATS_ADD(field, 1)
+
+#ifdef PSH_SIM_TIMERS
+#define SIM_STATS_CONCAT_(a, b) a##b
+#define SIM_STATS_CONCAT(a, b) SIM_STATS_CONCAT_(a, b)
+#define SIM_STATS_TIMER(timer)                                      \
+  ::icfpc2019::ScopedCycleTimer SIM_STATS_CONCAT(sim_stats_timer_,  \
+                                                 __LINE__)(         \
+      ::icfpc2019::SimStats::timer)
+#else
+#define SIM_STATS_TIMER(timer) ((void)0)
+#endif
+
+#endif  // SIM_STATS_H_
@@ -0,0 +1,91 @@
+#include "sim_stats.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "simulator.h"
+
+namespace icfpc2019 {
+namespace {
+
+Desc MakeDesc() {
+  Desc desc;
+  desc.map_ = {{0, 0}, {10, 0}, {10, 10}, {0, 10}};
+  desc.point = {0, 0};
+  return desc;
+}
+
+Map::RunResult RunFirst(Map* map, Instruction::Type type) {
+  return map->Run(0, Instruction{type});
+}
+
+TEST(SimStatsTest, Merge) {
+  SimStats a, b;
+  a.run_calls = 2;
+  a.run_results[0] = 1;
+  a.peak_undo_depth = 5;
+  b.run_calls = 3;
+  b.run_results[0] = 4;
+  b.peak_undo_depth = 3;
+  b.cycles[SimStats::UNDO] = 7;
+  a.Merge(b);
+  EXPECT_EQ(5u, a.run_calls);
+  EXPECT_EQ(5u, a.run_results[0]);
+  EXPECT_EQ(5u, a.peak_undo_depth);
+  EXPECT_EQ(7u, a.cycles[SimStats::UNDO]);
+}
+
+TEST(SimStatsTest, ToJson) {
+  SimStats stats;
+  stats.run_results[3] = 2;
+  const auto json = stats.ToJson();
+  EXPECT_NE(std::string::npos, json.find("\"WALL\": 2")) << json;
+  EXPECT_NE(std::string::npos, json.find("\"peak_undo_depth\": 0")) << json;
+}
+
+#ifdef PSH_SIM_STATS
+
+TEST(SimStatsTest, CountsPerThread) {
+  ResetSimStats();
+  Map map(MakeDesc());
+  ASSERT_EQ(Map::RunResult::SUCCESS, RunFirst(&map, Instruction::Type::W));
+  ASSERT_EQ(Map::RunResult::SUCCESS, RunFirst(&map, Instruction::Type::W));
+  ASSERT_EQ(Map::RunResult::OUT_OF_MAP, RunFirst(&map, Instruction::Type::A));
+  map.Undo();
+
+  const auto& stats = ThreadSimStats();
+  EXPECT_EQ(3u, stats.run_calls);
+  EXPECT_EQ(2u, stats.run_results[static_cast<int>(Map::RunResult::SUCCESS)]);
+  EXPECT_EQ(1u,
+            stats.run_results[static_cast<int>(Map::RunResult::OUT_OF_MAP)]);
+  EXPECT_EQ(1u, stats.undo_calls);
+  EXPECT_EQ(2u, stats.peak_undo_depth);
+  // Map construction fills too.
+  EXPECT_EQ(3u, stats.fill_calls);
+  EXPECT_GT(stats.cells_filled, 0u);
+
+  std::thread([] {
+    Map other(MakeDesc());
+    EXPECT_EQ(Map::RunResult::SUCCESS, RunFirst(&other, Instruction::Type::D));
+    EXPECT_EQ(1u, ThreadSimStats().run_calls);
+  }).join();
+  EXPECT_EQ(3u, ThreadSimStats().run_calls);
+  EXPECT_NE(std::string::npos, SimStatsJson().find("\"run\": 4"))
+      << SimStatsJson();
+}
+
+#else
+
+TEST(SimStatsTest, CompiledOut) {
+  Map map(MakeDesc());
+  ASSERT_EQ(Map::RunResult::SUCCESS, RunFirst(&map, Instruction::Type::W));
+  map.Undo();
+  EXPECT_EQ(0u, ThreadSimStats().run_calls);
+  EXPECT_EQ(0u, ThreadSimStats().fill_calls);
+}
+
+#endif
+
+}  // namespace
+}  // namespace icfpc2019
@@ -1,18 +1,26 @@
 #include "simulator.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "glog/logging.h"
 
-#include "rational.h"
+#include "raster.h"
+#include "sim_stats.h"
+#include "visibility.h"
 
 namespace icfpc2019 {
 namespace {
 
+static_assert(static_cast<int>(Map::RunResult::UNKNOWN_INSTRUCTION) + 1 ==
+              SimStats::kNumRunResults, "Update SimStats for RunResult");
+
 Point ParsePoint(absl::string_view s) {
   int pos[2];
   int index = 0;
@@ -65,127 +73,28 @@ std::vector<std::pair<Point, Booster>> ParseBoosters(absl::string_view s) {
   return result;
 }
 
-Program ParseProgram(absl::string_view s) {
-  Program result;
-  for (std::size_t i = 0; i < s.length(); ++i) {
-    Instruction inst;
-    switch (s[i]) {
-      case 'W': inst.type = Instruction::Type::W; break;
-      case 'S': inst.type = Instruction::Type::S; break;
-      case 'A': inst.type = Instruction::Type::A; break;
-      case 'D': inst.type = Instruction::Type::D; break;
-      case 'Q': inst.type = Instruction::Type::Q; break;
-      case 'E': inst.type = Instruction::Type::E; break;
-      case 'Z': inst.type = Instruction::Type::Z; break;
-      case 'B': inst.type = Instruction::Type::B; break;
-      case 'F': inst.type = Instruction::Type::F; break;
-      case 'L': inst.type = Instruction::Type::L; break;
-      case 'R': inst.type = Instruction::Type::R; break;
-      case 'T': inst.type = Instruction::Type::T; break;
-      case 'C': inst.type = Instruction::Type::C; break;
-    }
-    if(s[i] == 'B' || s[i] == 'T'){
-      int begin = i + 2;
-      int end = s.find(')', begin);
-      inst.arg = ParsePoint(s.substr(begin, end - begin));
-      i = end;
-    }
-    result.push_back(std::move(inst));
-  }
-  return result;
-}
-
-std::vector<Cell> ConvertMap(
-    std::size_t width,
-    std::size_t height,
-    const std::vector<Point>& m,
-    const std::vector<std::vector<Point>>& obstacles) {
-  std::vector<Cell> result(width * height, Cell::WALL);
-  std::vector<int> bars;
-  // map.
-  for (int y = 0; y < static_cast<int>(height); ++y) {
-    bars.clear();
-    for (std::size_t i = 0; i < m.size(); ++i) {
-      const auto& p1 = m[i];
-      const auto& p2 = m[(i + 1) % m.size()];
-      if (p1.x != p2.x) continue;
-      auto yrange = std::minmax(p1.y, p2.y);
-      if (yrange.first <= y && y < yrange.second) {
-        bars.push_back(p1.x);
-      }
-    }
-    std::sort(bars.begin(), bars.end());
-    for (std::size_t i = 0; i < bars.size(); i += 2) {
-      for (int x = bars[i]; x < bars[i + 1]; ++x) {
-        result[y * width + x] = Cell::EMPTY;
-      }
-    }
-  }
-
-  // obstacles.
-  for (int y = 0; y < static_cast<int>(height); ++y) {
-    bars.clear();
-    for (const auto& obstacle : obstacles) {
-      for (std::size_t i = 0; i < obstacle.size(); ++i) {
-        const auto& p1 = obstacle[i];
-        const auto& p2 = obstacle[(i + 1) % obstacle.size()];
-        if (p1.x != p2.x) continue;
-        auto yrange = std::minmax(p1.y, p2.y);
-        if (yrange.first <= y && y < yrange.second) {
-          bars.push_back(p1.x);
-        }
-      }
-    }
-    std::sort(bars.begin(), bars.end());
-    for (std::size_t i = 0; i < bars.size(); i += 2) {
-      for (int x = bars[i]; x < bars[i + 1]; ++x) {
-        result[y * width + x] = Cell::WALL;
-      }
-    }
-  }
-
-  return result;
-}
-
 bool IsVisibleImpl(const Point& origin, const Point& target,
-                   const std::vector<Cell>& m,
-                   std::size_t width, std::size_t height) {
-  std::vector<Point> points;
-  if (origin.x == target.x) {
-    int miny, maxy;
-    std::tie(miny, maxy) = std::minmax(origin.y, target.y);
-    for (int y = miny; y <= maxy; ++y) {
-      points.push_back(Point{origin.x, y});
-    }
-  } else {
-    Point s = origin, g = target;
-    if (s.x > g.x) {
-      std::swap(s, g);
-    }
-
-    const auto grad = Rational(g.y - s.y, g.x - s.x);
-    for (int x = s.x; x <= g.x; ++x) {
-      auto left = std::max(Rational(s.x), Rational(x) - Rational(1, 2));
-      auto right = std::min(Rational(g.x), Rational(x) + Rational(1, 2));
-
-      auto left_y =
-          Rational(s.y) + (left - Rational(s.x)) * grad + Rational(1, 2);
-      auto right_y =
-          Rational(s.y) + (right - Rational(s.x)) * grad + Rational(1, 2);
-      int lo = std::min(Floor(left_y), Floor(right_y));
-      int hi = std::max(Ceil(left_y), Ceil(right_y));
-      for (int y = lo; y < hi; ++y) {
-        points.push_back(Point{x, y});
-      }
+                   const std::vector<Cell>& m, const CellLayout& layout) {
+  auto is_open = [&](int x, int y) {
+    return 0 <= y && y < layout.height() &&
+        0 <= x && x < layout.width() &&
+        m[layout.Slot(x, y)] != Cell::WALL;
+  };
+
+  const auto d = target - origin;
+  const auto& table = VisibilityTable::Get();
+  if (table.Contains(d)) {
+    for (const auto& cell : table.Cells(d)) {
+      if (!is_open(origin.x + cell.dx, origin.y + cell.dy))
+        return false;
     }
+    return true;
   }
 
-  for (const auto& p : points) {
-    if (p.y < 0 || static_cast<int>(height) <= p.y ||
-        p.x < 0 || static_cast<int>(width) <= p.x ||
-        m[p.y * width + p.x] == Cell::WALL) {
+  // Too far to be precomputed.
+  for (const auto& cell : CrossedCells(d)) {
+    if (!is_open(origin.x + cell.x, origin.y + cell.y))
       return false;
-    }
   }
   return true;
 }
@@ -217,6 +126,118 @@ bool IsPossibleToExtendManipulator(
   return false;
 }
 
+// Zobrist keys of Map::hash(). They are derived from the arguments by the
+// SplitMix64 finalizer rather than looked up in random tables, so they need
+// no storage and don't depend on the map size.
+enum class HashKind : std::uint64_t {
+  FILLED = 1,
+  BOOSTER,
+  RESET,
+  WRAPPER,
+  MANIPULATOR,
+  WRAPPER_STATE,
+  COLLECTED,
+};
+
+std::uint64_t Mix(std::uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+std::uint64_t ZobristKey(HashKind kind, std::uint64_t a, std::uint64_t b = 0) {
+  return Mix(Mix(static_cast<std::uint64_t>(kind) << 56 ^ a) ^ b);
+}
+
+std::uint64_t PackPoint(const Point& p) {
+  return static_cast<std::uint32_t>(p.x) |
+      static_cast<std::uint64_t>(static_cast<std::uint32_t>(p.y)) << 32;
+}
+
+// Hash of everything about the |index|-th wrapper.
+std::uint64_t WrapperHash(std::size_t index, const Wrapper& wrapper) {
+  std::uint64_t result =
+      ZobristKey(HashKind::WRAPPER, index, PackPoint(wrapper.point()));
+  for (const auto& manip : wrapper.manipulators()) {
+    result ^= ZobristKey(HashKind::MANIPULATOR, index, PackPoint(manip));
+  }
+  const std::uint64_t state =
+      wrapper.fast_count() | wrapper.drill_count() << 8 |
+      static_cast<std::uint64_t>(wrapper.pending_booster()) << 16;
+  return result ^ ZobristKey(HashKind::WRAPPER_STATE, index, state);
+}
+
+// Iterates a materialized Program like a ProgramReader.
+struct ProgramCursor {
+  bool done() const { return index == program->size(); }
+  bool TryNext(Instruction* inst) {
+    *inst = (*program)[index++];
+    return true;
+  }
+
+  const Program* program;
+  std::size_t index = 0;
+};
+
+// Runs the programs in lockstep. |Cursor| is ProgramCursor or
+// ProgramReader.
+template <typename Cursor>
+VerifyResult SimulateImpl(Map* m, std::vector<Cursor>* programs) {
+  VerifyResult result;
+  std::vector<Instruction> insts;
+  while (true) {
+    const std::size_t size = std::min(m->wrappers().size(), programs->size());
+    std::size_t acting = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      if (!(*programs)[i].done())
+        acting = i + 1;
+    }
+    if (acting == 0)
+      break;
+
+    // Wrappers whose programs ended stay idle, by Z if a later one acts.
+    // A malformed instruction fails like an unknown one would by Run().
+    insts.assign(acting, Instruction{Instruction::Type::Z});
+    for (std::size_t i = 0; i < acting; ++i) {
+      auto& program = (*programs)[i];
+      if (!program.done() && !program.TryNext(&insts[i])) {
+        result.failure = Map::RunResult::UNKNOWN_INSTRUCTION;
+        result.failed_wrapper = i;
+        break;
+      }
+    }
+    if (result.failure != Map::RunResult::SUCCESS)
+      break;
+
+    const auto step = m->Step(insts);
+    if (!step.ok()) {
+      result.failure = step.failure;
+      result.failed_wrapper = step.failed_wrapper;
+      break;
+    }
+    ++result.steps;
+  }
+  result.remaining = m->remaining();
+  return result;
+}
+
+bool PrintVerifyResult(const VerifyResult& result) {
+  if (result.failure != Map::RunResult::SUCCESS) {
+    std::cout << "Failed!: " << result.failure << " by wrapper "
+              << result.failed_wrapper << " at step " << result.steps;
+    return false;
+  }
+  if (result.remaining > 0) {
+    std::cout << "Failed!: Still remaining "
+              << result.remaining << " at step " << result.steps;
+    return false;
+  }
+
+  std::cout << "Success! Passed at step " << result.steps;
+  return true;
+}
+
 }  // namespace
 
 std::ostream& operator<<(std::ostream& os, const Point& point) {
@@ -253,6 +274,26 @@ std::ostream& operator<<(std::ostream& os, const Instruction& inst) {
   return os;
 }
 
+std::ostream& operator<<(std::ostream& os, Map::RunResult result) {
+  switch (result) {
+#define OUTPUT(x) \
+    case Map::RunResult::x: os << #x; break
+
+    OUTPUT(SUCCESS);
+    OUTPUT(NO_WRAPPER);
+    OUTPUT(OUT_OF_MAP);
+    OUTPUT(WALL);
+    OUTPUT(NO_BOOSTER);
+    OUTPUT(BAD_MANIPULATOR_POSITION);
+    OUTPUT(BAD_TELEPORT_POSITION);
+    OUTPUT(UNKNOWN_TELEPORT_POSITION);
+    OUTPUT(BAD_CLONE_POSITION);
+    OUTPUT(UNKNOWN_INSTRUCTION);
+#undef OUTPUT
+  }
+  return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const Instruction::Type& type) {
   switch (type) {
 #define OUTPUT(x) \
@@ -307,7 +348,7 @@ std::istream& operator>>(std::istream& is, Instruction &inst)
   return is;
 }
 
-Desc ParseDesc(const std::string& task) {
+Desc ParseDesc(absl::string_view task) {
   Desc result;
   int index = 0;
   for (auto token : absl::StrSplit(task, '#')) {
@@ -332,14 +373,106 @@ Desc ParseDesc(const std::string& task) {
   return result;
 }
 
-Solution ParseSolution(const std::string& solution) {
+Solution ParseSolution(absl::string_view solution) {
   Solution result;
-  for (auto token : absl::StrSplit(solution, '#')) {
-    result.programs.emplace_back(ParseProgram(token));
+  SolutionReader reader(solution);
+  for (auto& program : reader.programs()) {
+    result.programs.emplace_back();
+    while (!program.done()) {
+      result.programs.back().push_back(program.Next());
+    }
   }
   return result;
 }
 
+Instruction ProgramReader::Next() {
+  Instruction inst;
+  CHECK(TryNext(&inst)) << error_;
+  return inst;
+}
+
+bool ProgramReader::TryNext(Instruction* inst) {
+  DCHECK(!done());
+  *inst = Instruction();
+  const char c = text_[pos_++];
+  switch (c) {
+    case 'W': inst->type = Instruction::Type::W; break;
+    case 'S': inst->type = Instruction::Type::S; break;
+    case 'A': inst->type = Instruction::Type::A; break;
+    case 'D': inst->type = Instruction::Type::D; break;
+    case 'Q': inst->type = Instruction::Type::Q; break;
+    case 'E': inst->type = Instruction::Type::E; break;
+    case 'Z': inst->type = Instruction::Type::Z; break;
+    case 'B': inst->type = Instruction::Type::B; break;
+    case 'F': inst->type = Instruction::Type::F; break;
+    case 'L': inst->type = Instruction::Type::L; break;
+    case 'R': inst->type = Instruction::Type::R; break;
+    case 'T': inst->type = Instruction::Type::T; break;
+    case 'C': inst->type = Instruction::Type::C; break;
+    default:
+      error_ = absl::StrCat("Unknown instruction: ", std::string(1, c),
+                            " at ", pos_ - 1);
+      return false;
+  }
+  if (c == 'B' || c == 'T') {
+    if (!Expect('(') || !ReadInt(&inst->arg.x) || !Expect(',') ||
+        !ReadInt(&inst->arg.y) || !Expect(')'))
+      return false;
+  }
+  SkipSpaces();
+  return true;
+}
+
+void ProgramReader::SkipSpaces() {
+  while (pos_ < text_.size() &&
+         (text_[pos_] == ' ' || text_[pos_] == '\n' ||
+          text_[pos_] == '\r' || text_[pos_] == '\t'))
+    ++pos_;
+}
+
+bool ProgramReader::ReadInt(int* result) {
+  const bool negative = pos_ < text_.size() && text_[pos_] == '-';
+  if (negative)
+    ++pos_;
+  const std::size_t begin = pos_;
+  // The magnitude of INT_MIN is one more than INT_MAX.
+  const std::int64_t limit =
+      std::int64_t{std::numeric_limits<int>::max()} + negative;
+  std::int64_t value = 0;
+  while (pos_ < text_.size() && '0' <= text_[pos_] && text_[pos_] <= '9') {
+    value = value * 10 + (text_[pos_++] - '0');
+    if (value > limit) {
+      error_ = absl::StrCat("Number out of range at ", begin);
+      return false;
+    }
+  }
+  if (begin == pos_) {
+    error_ = absl::StrCat("Failed to read a number at ", pos_);
+    return false;
+  }
+  *result = negative ? -value : value;
+  return true;
+}
+
+bool ProgramReader::Expect(char c) {
+  if (pos_ < text_.size() && text_[pos_] == c) {
+    ++pos_;
+    return true;
+  }
+  error_ = absl::StrCat("Failed to find '", std::string(1, c), "' at ", pos_);
+  return false;
+}
+
+SolutionReader::SolutionReader(absl::string_view text) {
+  while (true) {
+    const auto end = text.find('#');
+    programs_.emplace_back(text.substr(0, end));
+    if (end == absl::string_view::npos)
+      break;
+    text.remove_prefix(end + 1);
+  }
+}
+
 std::ostream& operator<<(std::ostream& os, const Program& program) {
   for (const Instruction& inst : program) {
     os << inst;
@@ -357,28 +490,129 @@ std::ostream& operator<<(std::ostream& os, const Solution& solution) {
   return os;
 }
 
-Map::Map(const Desc& desc) {
-  width_ = 0;
-  height_ = 0;
+void Backlog::set_limit(std::size_t limit) {
+  limit_ = limit;
+  while (limit_ > 0 && size() > limit_) {
+    DropFront();
+  }
+}
+
+void Backlog::DropFront() {
+  ++first_;
+  if (first_ * 2 < entries_.size())
+    return;
+  const std::size_t cells_first =
+      first_ < entries_.size() ? entries_[first_].cells_begin() : cells_.size();
+  entries_.erase(entries_.begin(), entries_.begin() + first_);
+  cells_.erase(cells_.begin(), cells_.begin() + cells_first);
+  for (auto& entry : entries_) {
+    entry.set_cells_begin(entry.cells_begin() - cells_first);
+  }
+  first_ = 0;
+}
+
+Terrain::Terrain(const Desc& desc) : start_(desc.point) {
   for (const auto& p : desc.map_) {
-    width_ = std::max(static_cast<std::size_t>(p.x), width_);
-    height_ = std::max(static_cast<std::size_t>(p.y), height_);
+    width_ = std::max(p.x, width_);
+    height_ = std::max(p.y, height_);
+  }
+  cells_ = ConvertMap(width_, height_, desc.map_, desc.obstacles);
+  Init(desc.boosters);
+}
+
+Terrain::Terrain(int width, int height, const Point& start,
+                 std::vector<Cell> cells,
+                 const std::vector<std::pair<Point, Booster>>& boosters)
+    : width_(width), height_(height), start_(start), cells_(std::move(cells)) {
+  CHECK_EQ(cells_.size(), static_cast<std::size_t>(width_) * height_);
+  CHECK(0 <= start_.x && start_.x < width_ && 0 <= start_.y &&
+        start_.y < height_) << "Start " << start_ << " is out of the map";
+  Init(boosters);
+}
+
+void Terrain::Init(const std::vector<std::pair<Point, Booster>>& boosters) {
+  booster_ids_.assign(cells_.size(), kNoBooster);
+  for (const auto& booster : boosters) {
+    const auto& p = booster.first;
+    CHECK(0 <= p.x && p.x < width_ && 0 <= p.y && p.y < height_)
+        << "Booster " << p << " is out of the map";
+    auto& id = booster_ids_[p.y * width_ + p.x];
+    CHECK_EQ(id, kNoBooster) << "Two boosters at " << p;
+    CHECK_LT(boosters_.size(), kNoBooster) << "Too many boosters";
+    id = boosters_.size();
+    boosters_.push_back(booster);
+  }
+
+  // Slides the window down the map a row at a time, each row of it sliding
+  // along the row. Out of the map is wall.
+  constexpr int kReach = VisibilityTable::kWindowReach;
+  constexpr int kSide = VisibilityTable::kWindowSide;
+  constexpr int kTopShift = kSide * (kSide - 1);
+  const int width = width_, height = height_;
+  std::vector<std::uint32_t> windows(width, (1u << kSide * kSide) - 1);
+  std::vector<std::uint32_t> row(width + kReach);
+  wall_windows_.resize(cells_.size());
+  for (int y = 0; y < height + kReach; ++y) {
+    std::uint32_t bits = (1u << kSide) - 1;
+    for (int x = 0; x < width + kReach; ++x) {
+      const bool wall =
+          y >= height || x >= width || cells_[y * width + x] == Cell::WALL;
+      bits = bits >> 1 | static_cast<std::uint32_t>(wall) << (kSide - 1);
+      row[x] = bits;
+    }
+    // row[x + kReach] is centered at x.
+    const int center = y - kReach;
+    for (int x = 0; x < width; ++x) {
+      windows[x] = windows[x] >> kSide | row[x + kReach] << kTopShift;
+    }
+    if (center >= 0) {
+      std::copy(windows.begin(), windows.end(),
+                wall_windows_.begin() + center * width);
+    }
+  }
+}
+
+Map::Map(const Desc& desc) : Map(std::make_shared<const Terrain>(desc)) {
+}
+
+Map::Map(std::shared_ptr<const Terrain> terrain)
+    : terrain_(std::move(terrain)),
+      width_(terrain_->width()), height_(terrain_->height()),
+      layout_(width_, height_), taken_(terrain_->boosters().size(), 1) {
+  if (CellLayout::kRowMajor) {
+    map_ = terrain_->cells();
+  } else {
+    map_.assign(layout_.size(), Cell::WALL);
+    for (std::size_t y = 0; y < height_; ++y) {
+      for (std::size_t x = 0; x < width_; ++x)
+        map_[layout_.Slot(x, y)] = terrain_->cells()[y * width_ + x];
+    }
   }
-  map_ = ConvertMap(width_, height_, desc.map_, desc.obstacles);
-  booster_map_.insert(desc.boosters.begin(), desc.boosters.end());
-  wrappers_.push_back(Wrapper(desc.point));
+  for (const auto& booster : terrain_->boosters()) {
+    PutBackBooster(booster.first);
+  }
+  shared_chunks_.resize(layout_.num_chunks());
+  dirty_chunks_.assign(layout_.num_chunks(), 1);
+  wrappers_.push_back(Wrapper(terrain_->start()));
   Fill(wrappers_[0], nullptr);
   remaining_ = std::count(map_.begin(), map_.end(), Cell::EMPTY);
+
+  // Fill() and PutBackBooster() above already updated |hash_|, but the wrapper.
+  hash_ ^= WrapperHash(0, wrappers_[0]);
 }
 
 void Map::Undo() {
+  SIM_STATS_INC(undo_calls);
+  SIM_STATS_TIMER(UNDO);
+  CHECK(!backlogs_.empty()) << "Nothing to undo";
   const auto& log = backlogs_.back();
   auto& wrapper = wrappers_[log.wrapper_index()];
+  hash_ ^= WrapperHash(log.wrapper_index(), wrapper);
 
   switch (log.action()) {
     case BacklogEntry::Action::WW: {
       if (log.second_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.second_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{0, 1};
       wrapper.set_point(p);
@@ -386,7 +620,7 @@ void Map::Undo() {
     }
     case BacklogEntry::Action::W: {
       if (log.first_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.first_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{0, 1};
       wrapper.set_point(p);
@@ -394,7 +628,7 @@ void Map::Undo() {
     }
     case BacklogEntry::Action::AA: {
       if (log.second_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.second_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{-1, 0};
       wrapper.set_point(p);
@@ -402,7 +636,7 @@ void Map::Undo() {
     }
     case BacklogEntry::Action::A: {
       if (log.first_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.first_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{-1, 0};
       wrapper.set_point(p);
@@ -410,7 +644,7 @@ void Map::Undo() {
     }
     case BacklogEntry::Action::SS: {
       if (log.second_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.second_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{0, -1};
       wrapper.set_point(p);
@@ -418,7 +652,7 @@ void Map::Undo() {
     }
     case BacklogEntry::Action::S: {
       if (log.first_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.first_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{0, -1};
       wrapper.set_point(p);
@@ -426,15 +660,15 @@ void Map::Undo() {
     }
     case BacklogEntry::Action::DD: {
       if (log.second_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.second_booster());
+        PutBackBooster(wrapper.point());
       }
-      const auto p = wrapper.point() - Point{0, -1};
+      const auto p = wrapper.point() - Point{1, 0};
       wrapper.set_point(p);
       // fallthrough.
     }
     case BacklogEntry::Action::D: {
       if (log.first_booster() != Booster::X) {
-        booster_map_.emplace(wrapper.point(), log.first_booster());
+        PutBackBooster(wrapper.point());
       }
       const auto p = wrapper.point() - Point{1, 0};
       wrapper.set_point(p);
@@ -466,7 +700,11 @@ void Map::Undo() {
       break;
     }
     case BacklogEntry::Action::R: {
-      resets_.erase(wrapper.point());
+      SetResetPoint(wrapper.point(), false);
+      reset_points_.pop_back();
+      if (teleport_distances_)
+        teleport_distances_->RemoveLastResetPoint();
+      hash_ ^= ZobristKey(HashKind::RESET, Index(wrapper.point()));
       ++collected_r_;
       break;
     }
@@ -475,47 +713,330 @@ void Map::Undo() {
       break;
     }
     case BacklogEntry::Action::C: {
+      hash_ ^= WrapperHash(wrappers_.size() - 1, wrappers_.back());
       wrappers_.pop_back();
       ++collected_c_;
       break;
     }
   }
-  Unfill(log.updated_cells());
+  Unfill(backlogs_.back_cells());
+  wrapper.set_fast_count(log.fast_count());
+  wrapper.set_drill_count(log.drill_count());
 
-  switch (log.pending_booster()) {
-    case Booster::B:
-      --collected_b_;
-      break;
-    case Booster::F:
-      --collected_f_;
-      break;
-    case Booster::L:
-      --collected_l_;
-      break;
-    case Booster::R:
-      --collected_r_;
-      break;
-    case Booster::C:
-      --collected_c_;
-      break;
-    case Booster::X:
-      // Do nothing.
-      break;
-  }
-  wrapper.set_pending_booster(Booster::X);
+  if (auto* collected = Collected(log.pending_booster()))
+    --*collected;
+  wrapper.set_pending_booster(log.pending_booster());
+  hash_ ^= WrapperHash(log.wrapper_index(), wrapper);
   --num_steps_;
-  backlogs_.pop_back();
+  backlogs_.Pop();
 }
 
-void Map::Unfill(const std::vector<std::pair<Point, Cell>>& cells) {
-  for (const auto& item : cells) {
-    GetCell(item.first) = item.second;
-    if (item.second == Cell::EMPTY)
+Map::StepResult Map::Step(absl::Span<const Instruction> insts) {
+  StepResult result;
+  const int num_wrappers = wrappers_.size();
+  if (static_cast<int>(insts.size()) > num_wrappers) {
+    result.failed_wrapper = num_wrappers;
+    result.failure = RunResult::NO_WRAPPER;
+    return result;
+  }
+
+  // Boosters picked up in the previous step are usable by anyone from now.
+  StepLog log{0, static_cast<int>(flushed_boosters_.size()), 0};
+  for (int i = 0; i < num_wrappers; ++i) {
+    auto& wrapper = wrappers_[i];
+    if (wrapper.pending_booster() == Booster::X)
+      continue;
+    flushed_boosters_.emplace_back(i, wrapper.pending_booster());
+    hash_ ^= WrapperHash(i, wrapper);
+    ++*Collected(wrapper.pending_booster());
+    wrapper.set_pending_booster(Booster::X);
+    hash_ ^= WrapperHash(i, wrapper);
+  }
+
+  for (std::size_t i = 0; i < insts.size(); ++i) {
+    const int remaining = remaining_;
+    const auto run_result = Run(i, insts[i]);
+    if (run_result != RunResult::SUCCESS) {
+      for (; log.num_actions > 0; --log.num_actions) {
+        Undo();
+      }
+      UnflushBoosters(log.flushed_begin);
+      trace_records_.clear();
+      result.failed_wrapper = i;
+      result.failure = run_result;
+      return result;
+    }
+    ++log.num_actions;
+    if (trace_) {
+      trace_records_.push_back(
+          MakeTraceRecord(i, insts[i].type, remaining - remaining_));
+    }
+  }
+  log.end = num_steps_;
+  step_logs_.push_back(log);
+  if (trace_) {
+    // Wrappers without an instruction, but not the clones made just now.
+    for (int i = insts.size(); i < num_wrappers; ++i) {
+      trace_records_.push_back(MakeTraceRecord(i, Instruction::Type::Z, 0));
+    }
+    trace_->AppendStep(absl::MakeSpan(trace_records_));
+    trace_records_.clear();
+  }
+
+  // Keep the step logs about as long as the undo window.
+  const std::size_t limit = backlogs_.limit();
+  if (limit > 0 && step_logs_.size() > 2 * limit) {
+    const auto dropped = step_logs_.size() - limit;
+    const int flushed_first = step_logs_[dropped].flushed_begin;
+    step_logs_.erase(step_logs_.begin(), step_logs_.begin() + dropped);
+    flushed_boosters_.erase(flushed_boosters_.begin(),
+                            flushed_boosters_.begin() + flushed_first);
+    for (auto& step : step_logs_) {
+      step.flushed_begin -= flushed_first;
+    }
+  }
+  return result;
+}
+
+TraceRecord Map::MakeTraceRecord(int index, Instruction::Type type,
+                                 int wrapped) const {
+  const auto& wrapper = wrappers_[index];
+  TraceRecord record = {};
+  record.remaining = remaining_;
+  record.x = wrapper.point().x;
+  record.y = wrapper.point().y;
+  record.wrapper = index;
+  record.wrapped = wrapped;
+  record.instruction = static_cast<std::uint8_t>(type);
+  // Pending boosters were flushed at the beginning of the step.
+  record.picked = static_cast<std::uint8_t>(wrapper.pending_booster());
+  return record;
+}
+
+void Map::UndoStep() {
+  CHECK(!step_logs_.empty()) << "No step to undo";
+  const auto log = step_logs_.back();
+  CHECK_LE(log.num_actions, num_undoable())
+      << "Step is out of the undo window";
+  step_logs_.pop_back();
+  for (int i = 0; i < log.num_actions; ++i) {
+    Undo();
+  }
+  UnflushBoosters(log.flushed_begin);
+}
+
+void Map::UnflushBoosters(int begin) {
+  while (static_cast<int>(flushed_boosters_.size()) > begin) {
+    const auto flushed = flushed_boosters_.back();
+    flushed_boosters_.pop_back();
+    auto& wrapper = wrappers_[flushed.first];
+    hash_ ^= WrapperHash(flushed.first, wrapper);
+    --*Collected(flushed.second);
+    wrapper.set_pending_booster(flushed.second);
+    hash_ ^= WrapperHash(flushed.first, wrapper);
+  }
+}
+
+int* Map::Collected(Booster booster) {
+  switch (booster) {
+    case Booster::B: return &collected_b_;
+    case Booster::F: return &collected_f_;
+    case Booster::L: return &collected_l_;
+    case Booster::R: return &collected_r_;
+    case Booster::C: return &collected_c_;
+    case Booster::X: return nullptr;
+  }
+  return nullptr;
+}
+
+void Map::Unfill(absl::Span<const Backlog::CellDelta> cells) {
+  // In reverse order, as a cell may be updated twice in a step (e.g. a
+  // wrapper with fast wheels moving onto a cell wrapped by its manipulator).
+  SIM_STATS_ADD(cells_unfilled, cells.size());
+  for (auto iter = cells.rbegin(); iter != cells.rend(); ++iter) {
+    const auto slot = Backlog::DeltaIndex(*iter);
+    const auto orig = Backlog::DeltaCell(*iter);
+    if ((map_[slot] == Cell::FILLED) != (orig == Cell::FILLED))
+      hash_ ^= ZobristKey(HashKind::FILLED, slot);
+    map_[slot] = orig;
+    dirty_chunks_[layout_.Chunk(slot)] = 1;
+    if (bitboard_)
+      bitboard_->Set(layout_.PointOf(slot), orig);
+    if (distance_field_)
+      distance_field_->Update(Index(layout_.PointOf(slot)), orig);
+    if (teleport_distances_)
+      teleport_distances_->Update(Index(layout_.PointOf(slot)), orig);
+    if (orig == Cell::EMPTY) {
       ++remaining_;
+      if (components_)
+        components_->Add(Index(layout_.PointOf(slot)));
+    } else if (orig == Cell::WALL) {
+      --num_drilled_;
+    }
+  }
+}
+
+void Map::RestoreTo(int checkpoint) {
+  CHECK_LE(checkpoint, num_steps_);
+  CHECK_LE(num_steps_ - checkpoint, num_undoable())
+      << "Checkpoint is out of the undo window";
+  while (num_steps_ > checkpoint) {
+    if (!step_logs_.empty() && step_logs_.back().end == num_steps_) {
+      CHECK_GE(num_steps_ - step_logs_.back().num_actions, checkpoint)
+          << "Checkpoint is in the middle of a step";
+      UndoStep();
+    } else {
+      Undo();
+    }
   }
 }
 
+Map::Snapshot Map::TakeSnapshot() {
+  const std::size_t chunk_size = layout_.chunk_size();
+  for (std::size_t i = 0; i < shared_chunks_.size(); ++i) {
+    if (!dirty_chunks_[i])
+      continue;
+    const auto begin = map_.begin() + i * chunk_size;
+    shared_chunks_[i] =
+        std::make_shared<const std::vector<Cell>>(begin, begin + chunk_size);
+    dirty_chunks_[i] = 0;
+  }
+
+  Snapshot snapshot;
+  snapshot.chunks_ = shared_chunks_;
+  snapshot.taken_ = taken_;
+  snapshot.boosters_ = booster_points_;
+  snapshot.resets_ = reset_points_;
+  snapshot.wrappers_ = wrappers_;
+  snapshot.num_steps_ = num_steps_;
+  snapshot.remaining_ = remaining_;
+  snapshot.num_drilled_ = num_drilled_;
+  snapshot.hash_ = hash_;
+  snapshot.collected_b_ = collected_b_;
+  snapshot.collected_f_ = collected_f_;
+  snapshot.collected_l_ = collected_l_;
+  snapshot.collected_r_ = collected_r_;
+  snapshot.collected_c_ = collected_c_;
+  return snapshot;
+}
+
+void Map::Restore(const Snapshot& snapshot) {
+  CHECK_EQ(snapshot.chunks_.size(), shared_chunks_.size());
+  const std::size_t chunk_size = layout_.chunk_size();
+  for (std::size_t i = 0; i < shared_chunks_.size(); ++i) {
+    const auto& chunk = snapshot.chunks_[i];
+    if (!dirty_chunks_[i] && shared_chunks_[i] == chunk)
+      continue;
+    std::copy(chunk->begin(), chunk->end(), map_.begin() + i * chunk_size);
+    if (bitboard_) {
+      for (std::size_t j = 0; j < chunk_size; ++j) {
+        const auto p = layout_.PointOf(i * chunk_size + j);
+        if (InMap(p))
+          bitboard_->Set(p, (*chunk)[j]);
+      }
+    }
+    shared_chunks_[i] = chunk;
+    dirty_chunks_[i] = 0;
+  }
+
+  taken_ = snapshot.taken_;
+  booster_points_ = snapshot.boosters_;
+  for (const auto& p : reset_points_) {
+    SetResetPoint(p, false);
+  }
+  reset_points_ = snapshot.resets_;
+  for (const auto& p : reset_points_) {
+    SetResetPoint(p, true);
+  }
+
+  wrappers_ = snapshot.wrappers_;
+  num_steps_ = snapshot.num_steps_;
+  remaining_ = snapshot.remaining_;
+  num_drilled_ = snapshot.num_drilled_;
+  hash_ = snapshot.hash_;
+  if (components_) {
+    // Restoring may change any cells, so just rebuild.
+    components_.emplace(RowMajorCells(), width_, height_);
+  }
+  if (distance_field_)
+    distance_field_.emplace(RowMajorCells(), width_, height_);
+  if (teleport_distances_)
+    ResetTeleportDistances();
+  collected_b_ = snapshot.collected_b_;
+  collected_f_ = snapshot.collected_f_;
+  collected_l_ = snapshot.collected_l_;
+  collected_r_ = snapshot.collected_r_;
+  collected_c_ = snapshot.collected_c_;
+  backlogs_.Clear();
+  step_logs_.clear();
+  flushed_boosters_.clear();
+}
+
+Map::ActionSet Map::LegalActions(int index) const {
+  ActionSet actions;
+  if (index >= static_cast<int>(wrappers_.size()))
+    return actions;
+
+  const auto& wrapper = wrappers_[index];
+  auto add = [&actions](Instruction::Type type) {
+    actions.mask |= 1 << static_cast<int>(type);
+  };
+  add(Instruction::Type::Q);
+  add(Instruction::Type::E);
+  add(Instruction::Type::Z);
+
+  const auto& p = wrapper.point();
+  const bool drilling = wrapper.drill_count() > 0;
+  auto can_move = [&](int x, int y) {
+    return 0 <= x && x < static_cast<int>(width_) &&
+        0 <= y && y < static_cast<int>(height_) &&
+        (drilling || map_[layout_.Slot(x, y)] != Cell::WALL);
+  };
+  if (can_move(p.x, p.y + 1)) add(Instruction::Type::W);
+  if (can_move(p.x, p.y - 1)) add(Instruction::Type::S);
+  if (can_move(p.x - 1, p.y)) add(Instruction::Type::A);
+  if (can_move(p.x + 1, p.y)) add(Instruction::Type::D);
+
+  const auto pending = wrapper.pending_booster();
+  if (collected_b_ > 0 || pending == Booster::B) {
+    // New manipulators must be adjacent to the wrapper or another one.
+    constexpr Point kDirs[] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}};
+    auto add_around = [&](const Point& base) {
+      for (const auto& dir : kDirs) {
+        const auto cand = base + dir;
+        if (IsPossibleToExtendManipulator(wrapper, cand) &&
+            std::find(actions.manipulators.begin(), actions.manipulators.end(),
+                      cand) == actions.manipulators.end())
+          actions.manipulators.push_back(cand);
+      }
+    };
+    add_around(Point{0, 0});
+    for (const auto& manip : wrapper.manipulators()) {
+      add_around(manip);
+    }
+    if (!actions.manipulators.empty())
+      add(Instruction::Type::B);
+  }
+  if (collected_f_ > 0 || pending == Booster::F)
+    add(Instruction::Type::F);
+  if (collected_l_ > 0 || pending == Booster::L)
+    add(Instruction::Type::L);
+
+  const auto here = GetBooster(p);
+  if ((collected_r_ > 0 || pending == Booster::R) &&
+      !IsResetPoint(p) && here != Booster::X)
+    add(Instruction::Type::R);
+  if (!reset_points_.empty()) {
+    actions.teleports = reset_points_;
+    add(Instruction::Type::T);
+  }
+  if ((collected_c_ > 0 || pending == Booster::C) && here == Booster::X)
+    add(Instruction::Type::C);
+  return actions;
+}
+
 Map::RunResult Map::DryRun(int index, const Instruction& inst) const {
+  SIM_STATS_INC(dry_run_calls);
   if (index >= static_cast<int>(wrappers_.size())) {
     return RunResult::NO_WRAPPER;
   }
@@ -552,21 +1073,18 @@ Map::RunResult Map::DryRun(int index, const Instruction& inst) const {
       if (collected_r_ == 0 && wrapper.pending_booster() != Booster::R)
         return RunResult::NO_BOOSTER;
       const auto& p = wrapper.point();
-      auto iter = booster_map_.find(p);
-      if (resets_.find(p) != resets_.end() ||
-          (iter != booster_map_.end() && iter->second == Booster::X))
+      if (IsResetPoint(p) || GetBooster(p) == Booster::X)
         return RunResult::BAD_TELEPORT_POSITION;
       return RunResult::SUCCESS;
     }
     case Instruction::Type::T:
-      if (resets_.find(inst.arg) == resets_.end())
+      if (!InMap(inst.arg) || !IsResetPoint(inst.arg))
         return RunResult::UNKNOWN_TELEPORT_POSITION;
       return RunResult::SUCCESS;
     case Instruction::Type::C: {
-      if (collected_c_ == 0 && wrapper.pending_booster() != Booster::R)
+      if (collected_c_ == 0 && wrapper.pending_booster() != Booster::C)
         return RunResult::NO_BOOSTER;
-      auto iter = booster_map_.find(wrapper.point());
-      if (iter == booster_map_.end() || iter->second != Booster::X)
+      if (GetBooster(wrapper.point()) != Booster::X)
         return RunResult::BAD_CLONE_POSITION;
       return RunResult::SUCCESS;
     }
@@ -575,7 +1093,10 @@ Map::RunResult Map::DryRun(int index, const Instruction& inst) const {
 }
 
 Map::RunResult Map::Run(int index, const Instruction& inst) {
+  SIM_STATS_INC(run_calls);
+  SIM_STATS_TIMER(RUN);
   auto dryrun_result = DryRun(index, inst);
+  SIM_STATS_INC(run_results[static_cast<int>(dryrun_result)]);
   if (dryrun_result != RunResult::SUCCESS)
     return dryrun_result;
   RunUnsafe(index, inst);
@@ -584,35 +1105,19 @@ Map::RunResult Map::Run(int index, const Instruction& inst) {
 
 void Map::RunUnsafe(int index, const Instruction& inst) {
   ++num_steps_;
-  BacklogEntry entry;
+  auto& entry = backlogs_.Push();
+  SIM_STATS_MAX(peak_undo_depth, backlogs_.size());
   entry.set_wrapper_index(index);
   CHECK_LT(index, static_cast<int>(wrappers_.size()));
   {
     auto& wrapper = wrappers_[index];
+    hash_ ^= WrapperHash(index, wrapper);
     entry.set_drill_count(wrapper.drill_count());
     entry.set_fast_count(wrapper.fast_count());
 
     entry.set_pending_booster(wrapper.pending_booster());
-    switch (wrapper.pending_booster()) {
-      case Booster::B:
-        ++collected_b_;
-        break;
-      case Booster::F:
-        ++collected_f_;
-        break;
-      case Booster::L:
-        ++collected_l_;
-        break;
-      case Booster::R:
-        ++collected_r_;
-        break;
-      case Booster::C:
-        ++collected_c_;
-        break;
-      case Booster::X:
-        // Do nothing.
-        break;
-    }
+    if (auto* collected = Collected(wrapper.pending_booster()))
+      ++*collected;
     wrapper.set_pending_booster(Booster::X);
 
     switch (inst.type) {
@@ -635,12 +1140,12 @@ void Map::RunUnsafe(int index, const Instruction& inst) {
       case Instruction::Type::Q:
         entry.set_action(BacklogEntry::Action::Q);
         wrapper.RotateCounterClockwise();
-        Fill(wrapper, &entry);
+        Fill(wrapper, &backlogs_);
         break;
       case Instruction::Type::E:
         entry.set_action(BacklogEntry::Action::E);
         wrapper.RotateClockwise();
-        Fill(wrapper, &entry);
+        Fill(wrapper, &backlogs_);
         break;
       case Instruction::Type::Z:
         entry.set_action(BacklogEntry::Action::Z);
@@ -651,7 +1156,7 @@ void Map::RunUnsafe(int index, const Instruction& inst) {
         CHECK(IsPossibleToExtendManipulator(wrapper, inst.arg));
         wrapper.AddManipulator(inst.arg);
         --collected_b_;
-        Fill(wrapper, &entry);
+        Fill(wrapper, &backlogs_);
         break;
       }
       case Instruction::Type::F: {
@@ -674,26 +1179,30 @@ void Map::RunUnsafe(int index, const Instruction& inst) {
         // appeared to the Wrapper-j where i < j.
         CHECK_GT(collected_r_, 0);
         const auto& p = wrapper.point();
-        CHECK(resets_.find(p) != resets_.end());
-        auto iter = booster_map_.find(p);
-        CHECK(iter == booster_map_.end() || iter->second == Booster::X);
-        resets_.insert(p);
+        CHECK(!IsResetPoint(p));
+        CHECK(GetBooster(p) != Booster::X);
+        SetResetPoint(p, true);
+        reset_points_.push_back(p);
+        if (teleport_distances_)
+          teleport_distances_->AddResetPoint(Index(p));
+        hash_ ^= ZobristKey(HashKind::RESET, Index(p));
+        --collected_r_;
         break;
       }
       case Instruction::Type::T: {
         entry.set_action(BacklogEntry::Action::T);
         entry.set_orig_pos(wrapper.point());
-        CHECK(resets_.find(inst.arg) != resets_.end());
+        CHECK(IsResetPoint(inst.arg));
         wrapper.set_point(inst.arg);
-        Fill(wrapper, &entry);
+        Fill(wrapper, &backlogs_);
         break;
       }
       case Instruction::Type::C: {
         entry.set_action(BacklogEntry::Action::C);
         CHECK_GT(collected_c_, 0);
-        const auto& p = wrapper.point();
-        auto iter = booster_map_.find(p);
-        CHECK(iter != booster_map_.end() && iter->second == Booster::X);
+        const auto p = wrapper.point();
+        CHECK(GetBooster(p) == Booster::X);
+        --collected_c_;
         wrappers_.emplace_back(p);  // Do not touch wrapper after this.
         break;
       }
@@ -711,13 +1220,88 @@ void Map::RunUnsafe(int index, const Instruction& inst) {
     if (drill_count > 0) {
       wrapper.set_drill_count(drill_count - 1);
     }
+    hash_ ^= WrapperHash(index, wrapper);
+    if (inst.type == Instruction::Type::C) {
+      hash_ ^= WrapperHash(wrappers_.size() - 1, wrappers_.back());
+    }
   }
 
-  backlogs_.push_back(std::move(entry));
+}
+
+std::uint64_t Map::hash() const {
+  const std::uint64_t collected =
+      static_cast<std::uint64_t>(collected_b_) |
+      static_cast<std::uint64_t>(collected_f_) << 12 |
+      static_cast<std::uint64_t>(collected_l_) << 24 |
+      static_cast<std::uint64_t>(collected_r_) << 36 |
+      static_cast<std::uint64_t>(collected_c_) << 48;
+  return hash_ ^ ZobristKey(HashKind::COLLECTED, collected);
 }
 
 bool Map::IsVisible(const Point& origin, const Point& target) const {
-    return IsVisibleImpl(origin, target, map_, width_, height_);
+  return Visible(origin, target);
+}
+
+bool Map::Visible(const Point& origin, const Point& target) const {
+  SIM_STATS_INC(visible_calls);
+  SIM_STATS_TIMER(VISIBLE);
+  const auto d = target - origin;
+  if (VisibilityTable::InWindow(d) && InMap(origin)) {
+    const auto mask = VisibilityTable::Get().WindowMask(d);
+    if ((terrain_->wall_window(Index(origin)) & mask) == 0)
+      return true;
+    // Walls are only ever removed from the terrain, so the terrain is
+    // exact unless some are drilled.
+    if (num_drilled_ == 0)
+      return false;
+  }
+  SIM_STATS_INC(visible_slow_calls);
+  return IsVisibleImpl(origin, target, map_, layout_);
+}
+
+void Map::EnableComponents() {
+  if (!components_)
+    components_.emplace(RowMajorCells(), width_, height_);
+}
+
+void Map::EnableDistanceField() {
+  if (!distance_field_)
+    distance_field_.emplace(RowMajorCells(), width_, height_);
+}
+
+void Map::EnableTeleportDistances() {
+  if (!teleport_distances_)
+    ResetTeleportDistances();
+}
+
+void Map::ResetTeleportDistances() {
+  teleport_distances_.emplace(RowMajorCells(), width_, height_);
+  for (const auto& p : reset_points_) {
+    teleport_distances_->AddResetPoint(Index(p));
+  }
+}
+
+const std::vector<Cell>& Map::RowMajorCells() {
+  if (CellLayout::kRowMajor)
+    return map_;
+  row_major_cells_.resize(width_ * height_);
+  for (std::size_t y = 0; y < height_; ++y) {
+    for (std::size_t x = 0; x < width_; ++x)
+      row_major_cells_[y * width_ + x] = map_[layout_.Slot(x, y)];
+  }
+  return row_major_cells_;
+}
+
+void Map::EnableBitboard() {
+  if (bitboard_)
+    return;
+  bitboard_.emplace(width_, height_);
+  for (int y = 0; y < static_cast<int>(height_); ++y) {
+    for (int x = 0; x < static_cast<int>(width_); ++x) {
+      const Point p{x, y};
+      bitboard_->Set(p, (*this)[p]);
+    }
+  }
 }
 
 std::string Map::ToString() const {
@@ -740,10 +1324,9 @@ std::string Map::ToString() const {
   }
 
   // Overwrite booster.
-  for (const auto& kv : booster_map_) {
-    const auto& p = kv.first;
+  for (const auto& p : booster_points_) {
     int index = (height_ - p.y - 1) * (width_ + 1) + p.x;
-    switch (kv.second) {
+    switch (*GetBooster(p)) {
       case Booster::B:
         result[index] = result[index] == '.' ? 'B' : 'b';
         break;
@@ -774,6 +1357,8 @@ std::string Map::ToString() const {
     }
     for (const auto& manip : wrapper.manipulators()) {
       const auto& p = wrapper.point() + manip;
+      if (!InMap(p))
+        continue;
       int index = (height_ - p.y - 1) * (width_ + 1) + p.x;
       if (result[index] == ' ' || result[index] == '.') {
         result[index] = '&';
@@ -805,23 +1390,49 @@ bool Map::MoveInternal(Wrapper* wrapper, const Point& direction,
 
   auto p = wrapper->point() + direction;
   wrapper->set_point(p);
-  Fill(*wrapper, entry);
-
-  auto iter = booster_map_.find(p);
-  if (iter != booster_map_.end()) {
-    if (iter->second != Booster::X) {
-      booster_map_.erase(p);
-      wrapper->set_pending_booster(iter->second);
-      if (is_first) {
-        entry->set_first_booster(iter->second);
-      } else {
-        entry->set_second_booster(iter->second);
-      }
+  Fill(*wrapper, &backlogs_);
+
+  const auto b = GetBooster(p);
+  if (b && *b != Booster::X) {
+    const auto booster = *b;
+    TakeBooster(p);
+    wrapper->set_pending_booster(booster);
+    if (is_first) {
+      entry->set_first_booster(booster);
+    } else {
+      entry->set_second_booster(booster);
     }
   }
   return true;
 }
 
+void Map::PutBackBooster(const Point& p) {
+  const auto id = terrain_->booster_id(Index(p));
+  DCHECK(taken_[id]);
+  taken_[id] = 0;
+  hash_ ^= ZobristKey(HashKind::BOOSTER, Index(p),
+                      static_cast<int>(terrain_->boosters()[id].second));
+  booster_points_.push_back(p);
+}
+
+void Map::TakeBooster(const Point& p) {
+  const auto id = terrain_->booster_id(Index(p));
+  DCHECK(!taken_[id]);
+  taken_[id] = 1;
+  hash_ ^= ZobristKey(HashKind::BOOSTER, Index(p),
+                      static_cast<int>(terrain_->boosters()[id].second));
+  // Boosters are few, so linear search is cheap enough here.
+  auto iter = std::find(booster_points_.begin(), booster_points_.end(), p);
+  *iter = booster_points_.back();
+  booster_points_.pop_back();
+}
+
+void Map::SetResetPoint(const Point& p, bool value) {
+  if (resets_.empty())
+    resets_.assign(width_ * height_, 0);
+  resets_[Index(p)] = value;
+}
+
 Map::RunResult Map::DryMove(const Wrapper& wrapper, const Point& direction)
     const {
   auto p = wrapper.point() + direction;
@@ -833,74 +1444,80 @@ Map::RunResult Map::DryMove(const Wrapper& wrapper, const Point& direction)
   return RunResult::SUCCESS;
 }
 
-void Map::Fill(const Wrapper& wrapper, BacklogEntry* entry) {
+void Map::Fill(const Wrapper& wrapper, Backlog* backlog) {
+  SIM_STATS_INC(fill_calls);
+  SIM_STATS_TIMER(FILL);
+  SIM_STATS_ADD(cells_examined, 1 + wrapper.manipulators().size());
   {
-    auto& cell = GetCell(wrapper.point());
+    const auto slot = Slot(wrapper.point());
+    auto& cell = map_[slot];
     if (cell == Cell::EMPTY) {
       --remaining_;
+      if (components_)
+        components_->Remove(Index(wrapper.point()));
+    } else if (cell == Cell::WALL) {
+      ++num_drilled_;
+    }
+    if (backlog)
+      backlog->AddCell(slot, cell);
+    if (cell != Cell::FILLED) {
+      SIM_STATS_INC(cells_filled);
+      cell = Cell::FILLED;
+      hash_ ^= ZobristKey(HashKind::FILLED, slot);
+      dirty_chunks_[layout_.Chunk(slot)] = 1;
+      if (bitboard_)
+        bitboard_->Set(wrapper.point(), Cell::FILLED);
+      if (distance_field_)
+        distance_field_->Update(Index(wrapper.point()), Cell::FILLED);
+      if (teleport_distances_)
+        teleport_distances_->Update(Index(wrapper.point()), Cell::FILLED);
     }
-    if (entry)
-      entry->add_updated_cell(wrapper.point(), cell);
-    cell = Cell::FILLED;
   }
   for (const auto& manip : wrapper.manipulators()) {
     const auto p = wrapper.point() + manip;
-    if (!IsVisibleImpl(wrapper.point(), p, map_, width_, height_)) {
+    if (!Visible(wrapper.point(), p)) {
       continue;
     }
-    auto& cell = GetCell(p);
+    const auto slot = Slot(p);
+    auto& cell = map_[slot];
     if (cell != Cell::FILLED) {
-      if (entry)
-        entry->add_updated_cell(p, cell);
+      if (backlog)
+        backlog->AddCell(slot, cell);
+      SIM_STATS_INC(cells_filled);
       cell = Cell::FILLED;
+      hash_ ^= ZobristKey(HashKind::FILLED, slot);
+      dirty_chunks_[layout_.Chunk(slot)] = 1;
+      if (bitboard_)
+        bitboard_->Set(p, Cell::FILLED);
+      if (components_)
+        components_->Remove(Index(p));
+      if (distance_field_)
+        distance_field_->Update(Index(p), Cell::FILLED);
+      if (teleport_distances_)
+        teleport_distances_->Update(Index(p), Cell::FILLED);
       --remaining_;
     }
   }
 }
 
-bool Verify(Map* m, const Solution& sol) {
-  std::vector<std::size_t> index_list;
-  index_list.push_back(0);
-  int steps = 0;
-  while (true) {
-    bool is_ended = true;
-    std::size_t size = std::min(index_list.size(), sol.programs.size());
-    for (std::size_t i = 0; i < size; ++i) {
-      if (index_list[i] < sol.programs[i].size()) {
-        is_ended = false;
-        break;
-      }
-    }
-    if (is_ended)
-      break;
-
-    // Run wrappers in order.
-    for (std::size_t i = 0; i < size; ++i) {
-      if (index_list[i] < sol.programs[i].size())
-        m->Run(i, sol.programs[i][index_list[i]]);
-    }
-
-    // Update index list.
-    for (std::size_t i = 0; i < size; ++i) {
-      if (index_list[i] < sol.programs[i].size()) {
-        ++index_list[i];
-      }
-    }
-    while (index_list.size() < m->wrappers().size()) {
-      index_list.push_back(0);
-    }
-
-    ++steps;
+VerifyResult Simulate(Map* m, const Solution& sol) {
+  std::vector<ProgramCursor> programs;
+  for (const auto& program : sol.programs) {
+    programs.push_back(ProgramCursor{&program});
   }
+  return SimulateImpl(m, &programs);
+}
 
-  if (m->remaining() > 0) {
-    std::cout << "Failed!: Still remaining "
-              << m->remaining() << " at step " << steps;
-    return false;
-  }
+VerifyResult Simulate(Map* m, SolutionReader* sol) {
+  return SimulateImpl(m, &sol->programs());
+}
 
-  std::cout << "Success! Passed at step " << steps;
-  return true;
+bool Verify(Map* m, const Solution& sol) {
+  return PrintVerifyResult(Simulate(m, sol));
+}
+
+bool Verify(Map* m, SolutionReader* sol) {
+  return PrintVerifyResult(Simulate(m, sol));
 }
 
 }  // namepace icfpc2019
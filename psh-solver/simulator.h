@@ -2,59 +2,25 @@
 #define SIMULATOR_H_
 
 #include <cstdint>
-#include <map>
-#include <vector>
-#include <set>
+#include <iosfwd>
+#include <memory>
+#include <string>
 #include <tuple>
+#include <vector>
 
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 
-namespace icfpc2019 {
-
-struct Point {
-  int x;
-  int y;
-
-  friend bool operator==(const Point& lhs, const Point& rhs) {
-    return std::tie(lhs.x, lhs.y) == std::tie(rhs.x, rhs.y);
-  }
-  friend bool operator!=(const Point& lhs, const Point& rhs) {
-    return std::tie(lhs.x, lhs.y) != std::tie(rhs.x, rhs.y);
-  }
-  bool operator<(const Point& other) const {
-    return std::tie(x, y) < std::tie(other.x, other.y);
-  }
-
-  Point& operator+=(const Point& other) {
-    x += other.x;
-    y += other.y;
-    return *this;
-  }
-
-  Point& operator-=(const Point& other) {
-    x -= other.x;
-    y -= other.y;
-    return *this;
-  }
-
-  friend Point operator+(const Point& lhs, const Point& rhs) {
-    return {lhs.x + rhs.x, lhs.y + rhs.y};
-  }
-
-  friend Point operator-(const Point& lhs, const Point& rhs) {
-    return {lhs.x - rhs.x, lhs.y - rhs.y};
-  }
-
-};
+#include "bitboard.h"
+#include "components.h"
+#include "distance_field.h"
+#include "grid.h"
+#include "layout.h"
+#include "teleport_distances.h"
+#include "trace.h"
 
-std::ostream& operator<<(std::ostream& os, const Point& point);
-std::istream& operator>>(std::istream& is, Point& point);
-
-enum class Cell : std::uint8_t {
-  EMPTY,
-  FILLED,
-  WALL,
-};
+namespace icfpc2019 {
 
 enum class Booster : std::uint8_t {
   B,
@@ -98,7 +64,7 @@ std::ostream& operator<<(std::ostream& os, const Instruction::Type& type);
 
 std::istream& operator>>(std::istream& is, Instruction& inst);
 
-Desc ParseDesc(const std::string& task);
+Desc ParseDesc(absl::string_view task);
 
 using Program = std::vector<Instruction>;
 
@@ -106,7 +72,46 @@ struct Solution {
   std::vector<Program> programs;
 };
 
-Solution ParseSolution(const std::string& solution);
+Solution ParseSolution(absl::string_view solution);
+
+// Decodes a program in the .sol format one instruction at a time, straight
+// from |text|, which must outlive the reader. Whitespace is skipped.
+class ProgramReader {
+ public:
+  explicit ProgramReader(absl::string_view text) : text_(text) {
+    SkipSpaces();
+  }
+
+  bool done() const { return pos_ == text_.size(); }
+  // Must not be done(). Dies if the instruction is malformed.
+  Instruction Next();
+  // Same as Next(), but returns false if the instruction is malformed,
+  // leaving the reason in error().
+  bool TryNext(Instruction* inst);
+
+  const std::string& error() const { return error_; }
+
+ private:
+  void SkipSpaces();
+  bool ReadInt(int* result);
+  bool Expect(char c);
+
+  absl::string_view text_;
+  std::size_t pos_ = 0;
+  std::string error_;
+};
+
+// Splits a solution in the .sol format into programs without decoding
+// them, so that it can be simulated without materializing a Solution.
+class SolutionReader {
+ public:
+  explicit SolutionReader(absl::string_view text);
+
+  std::vector<ProgramReader>& programs() { return programs_; }
+
+ private:
+  std::vector<ProgramReader> programs_;
+};
 
 std::ostream& operator<<(std::ostream& os, const Program& program);
 std::ostream& operator<<(std::ostream& os, const Solution& solution);
@@ -192,13 +197,6 @@ class BacklogEntry {
   Action action() const { return action_; }
   void set_action(Action a) { action_ = a; }
 
-  const std::vector<std::pair<Point, Cell>>& updated_cells() const {
-    return updated_cells_;
-  }
-  void add_updated_cell(const Point& point, const Cell& orig) {
-    updated_cells_.emplace_back(point, orig);
-  }
-
   Booster first_booster() const { return first_booster_; }
   void set_first_booster(Booster b) { first_booster_ = b; }
 
@@ -206,37 +204,179 @@ class BacklogEntry {
   void set_second_booster(Booster b) { second_booster_ = b; }
 
   // For T.
-  const Point& orig_pos() const { return orig_pos_; }
-  void set_orig_pos(const Point& p) { orig_pos_ = p; }
+  Point orig_pos() const { return Point{orig_x_, orig_y_}; }
+  void set_orig_pos(const Point& p) {
+    orig_x_ = p.x;
+    orig_y_ = p.y;
+  }
+
+  // Offset of the first updated cell of this entry in Backlog.
+  std::uint32_t cells_begin() const { return cells_begin_; }
+  void set_cells_begin(std::uint32_t begin) { cells_begin_ = begin; }
 
  private:
-  // TODO using shorter bitwidth ints.
-  int wrapper_index_;
-  int drill_count_;
-  int fast_count_;
+  std::uint32_t cells_begin_ = 0;
+  std::int16_t orig_x_ = 0;
+  std::int16_t orig_y_ = 0;
+  std::uint16_t wrapper_index_ = 0;
+  std::uint8_t drill_count_ = 0;  // At most 31.
+  std::uint8_t fast_count_ = 0;  // At most 51.
   Booster pending_booster_ = Booster::X;
-  Action action_;
+  Action action_ = Action::Z;
   Booster first_booster_ = Booster::X;
   Booster second_booster_ = Booster::X;
+};
+static_assert(sizeof(BacklogEntry) == 16, "BacklogEntry should be packed");
+
+// Undo log of Map. Entries are fixed-size headers, and the cells updated by
+// them are stored back to back in one buffer, so that pushing and popping an
+// entry does not allocate once the buffers are warmed up.
+//
+// The log may be bounded to the last |limit| entries. Older entries are
+// dropped from the front, and the buffers are compacted once the dropped
+// part gets as large as the live part, so memory stays within 2x the window
+// at amortized O(1) cost per push.
+class Backlog {
+ public:
+  // CellLayout slot of the updated cell, and its original Cell in lower 2
+  // bits.
+  using CellDelta = std::uint32_t;
+
+  static CellDelta MakeDelta(std::size_t index, Cell orig) {
+    return static_cast<CellDelta>(index << 2 | static_cast<CellDelta>(orig));
+  }
+  static std::size_t DeltaIndex(CellDelta delta) { return delta >> 2; }
+  static Cell DeltaCell(CellDelta delta) {
+    return static_cast<Cell>(delta & 3);
+  }
+
+  bool empty() const { return entries_.size() == first_; }
+  std::size_t size() const { return entries_.size() - first_; }
+
+  // 0 means unlimited.
+  std::size_t limit() const { return limit_; }
+  void set_limit(std::size_t limit);
+
+  // Starts a new entry. The reference is valid until the next Push().
+  BacklogEntry& Push() {
+    if (limit_ > 0 && size() >= limit_)
+      DropFront();
+    entries_.emplace_back();
+    entries_.back().set_cells_begin(cells_.size());
+    return entries_.back();
+  }
+
+  // Records a cell update for the last entry.
+  void AddCell(std::size_t index, Cell orig) {
+    cells_.push_back(MakeDelta(index, orig));
+  }
+
+  const BacklogEntry& back() const { return entries_.back(); }
+
+  // Cells updated by the last entry, in updated order.
+  absl::Span<const CellDelta> back_cells() const {
+    const std::size_t begin = entries_.back().cells_begin();
+    return absl::MakeConstSpan(cells_.data() + begin, cells_.size() - begin);
+  }
+
+  void Pop() {
+    cells_.resize(entries_.back().cells_begin());
+    entries_.pop_back();
+  }
+
+  void Clear() {
+    entries_.clear();
+    cells_.clear();
+    first_ = 0;
+  }
+
+ private:
+  // For Map::Serialize() and Map::Deserialize().
+  friend class Map;
+
+  void DropFront();
+
+  std::vector<BacklogEntry> entries_;
+  std::vector<CellDelta> cells_;
+  // entries_[0, first_) are dropped, and so are their cells.
+  std::size_t first_ = 0;
+  std::size_t limit_ = 0;
+};
+
+// The static part of a problem: the dimensions, the grid as rasterized
+// from the .desc and the initial boosters. Built once, and shared
+// read-only by any number of Maps, also across threads.
+class Terrain {
+ public:
+  explicit Terrain(const Desc& desc);
+  // From an already rasterized grid, in Map::Index() order.
+  Terrain(int width, int height, const Point& start, std::vector<Cell> cells,
+          const std::vector<std::pair<Point, Booster>>& boosters);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  const Point& start() const { return start_; }
+
+  // Grid before any wrapping, in Map::Index() order.
+  const std::vector<Cell>& cells() const { return cells_; }
 
-  Point orig_pos_;
-  std::vector<std::pair<Point, Cell>> updated_cells_;
+  // Initial boosters. IDs are indices into this.
+  const std::vector<std::pair<Point, Booster>>& boosters() const {
+    return boosters_;
+  }
+  static constexpr std::uint16_t kNoBooster = 0xFFFF;
+  // ID of the booster initially at the cell |index|, or kNoBooster.
+  std::uint16_t booster_id(std::size_t index) const {
+    return booster_ids_[index];
+  }
+
+  // Walls (and cells out of the map) in the window around the cell
+  // |index|, in VisibilityTable::WindowBit() order.
+  std::uint32_t wall_window(std::size_t index) const {
+    return wall_windows_[index];
+  }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  Point start_;
+  std::vector<Cell> cells_;
+  std::vector<std::pair<Point, Booster>> boosters_;
+  // Indexes the boosters and the walls of |cells_|.
+  void Init(const std::vector<std::pair<Point, Booster>>& boosters);
+
+  std::vector<std::uint16_t> booster_ids_;
+  std::vector<std::uint32_t> wall_windows_;
 };
 
+// Mutable state of a wrapping in progress, on top of a shared Terrain.
 class Map {
  public:
   explicit Map(const Desc& desc);
+  explicit Map(std::shared_ptr<const Terrain> terrain);
+
+  const std::shared_ptr<const Terrain>& terrain() const { return terrain_; }
 
   Cell operator[](const Point& p) const {
-    return map_[Index(p)];
+    return map_[Slot(p)];
   }
 
   absl::optional<Booster> GetBooster(const Point& p) const {
-    auto iter = booster_map_.find(p);
-    return iter == booster_map_.end() ?
-        absl::nullopt : absl::make_optional(iter->second);
+    const auto id = terrain_->booster_id(Index(p));
+    return id == Terrain::kNoBooster || taken_[id] ?
+        absl::nullopt : absl::make_optional(terrain_->boosters()[id].second);
   }
 
+  // Locations of boosters still on the map, in no particular order.
+  const std::vector<Point>& booster_points() const { return booster_points_; }
+
+  bool IsResetPoint(const Point& p) const {
+    return !resets_.empty() && resets_[Index(p)];
+  }
+
+  // Installed reset points, in installed order.
+  const std::vector<Point>& reset_points() const { return reset_points_; }
+
   int width() const { return width_; }
   int height() const { return height_; }
 
@@ -268,12 +408,155 @@ class Map {
   };
   RunResult DryRun(int index, const Instruction& inst) const;
 
+  // Everything the |index|-th wrapper can run now, i.e. for which DryRun()
+  // returns RunResult::SUCCESS.
+  struct ActionSet {
+    bool Has(Instruction::Type type) const {
+      return mask >> static_cast<int>(type) & 1;
+    }
+
+    // Bit static_cast<int>(Instruction::Type) is set for each type legal
+    // with some argument.
+    std::uint16_t mask = 0;
+    // Legal arguments of B (relative to the wrapper) and T.
+    std::vector<Point> manipulators;
+    std::vector<Point> teleports;
+  };
+  ActionSet LegalActions(int index) const;
+
   RunResult Run(int index, const Instruction& inst);
   void RunUnsafe(int index, const Instruction& inst);
   void Undo();
 
+  struct StepResult {
+    bool ok() const { return failure == RunResult::SUCCESS; }
+
+    // The first wrapper whose instruction failed, and why. -1 if none.
+    int failed_wrapper = -1;
+    RunResult failure = RunResult::SUCCESS;
+  };
+  // Runs one time unit: |insts|[i] by the i-th wrapper, in order. Wrappers
+  // beyond |insts| stay idle, and clones made in this step may not act yet.
+  // Boosters picked up in the previous step become usable by all wrappers
+  // at the beginning of the step. All or nothing: if any instruction fails,
+  // the whole step is rolled back.
+  //
+  // Steps are undone by UndoStep(). Don't Undo() part of a step, nor
+  // RestoreTo() into the middle of one.
+  StepResult Step(absl::Span<const Instruction> insts);
+  void UndoStep();
+
+  // Starts appending every successful Step() to |trace| (which must outlive
+  // the tracing), or stops it if nullptr. Steps undone are not removed
+  // from the trace, so it is meant for replaying solutions. Off by default,
+  // and costs a branch per Step() then.
+  void set_trace(TraceWriter* trace) { trace_ = trace; }
+
+  // Number of steps which can be undone.
+  int num_undoable() const { return backlogs_.size(); }
+
+  // Keeps only the last |limit| steps undoable (0 means unlimited), so
+  // that long runs don't hold the whole history.
+  void set_undo_limit(std::size_t limit) { backlogs_.set_limit(limit); }
+
+  // Returns a mark of the current step, to roll back to by RestoreTo().
+  int Checkpoint() const { return num_steps_; }
+  // Undoes all steps after |checkpoint|, those made by Step() by UndoStep().
+  // They must be still undoable, and |checkpoint| must not be in the middle
+  // of a Step().
+  void RestoreTo(int checkpoint);
+
+  // Copy-on-write image of the mutable state (cells, boosters, reset points,
+  // wrappers and collected boosters) of a Map, without the undo log.
+  // Unchanged chunks (rows, or tiles; see CellLayout) of the grid are shared
+  // between the snapshots and the Map they were taken from, so taking and
+  // restoring one costs O(number of chunks + changed chunks). Snapshots are
+  // immutable and may be shared across threads.
+  class Snapshot {
+   public:
+    int num_steps() const { return num_steps_; }
+    int remaining() const { return remaining_; }
+
+   private:
+    friend class Map;
+
+    std::vector<std::shared_ptr<const std::vector<Cell>>> chunks_;
+    std::vector<std::uint8_t> taken_;
+    std::vector<Point> boosters_;
+    std::vector<Point> resets_;
+    std::vector<Wrapper> wrappers_;
+    int num_steps_ = 0;
+    int remaining_ = 0;
+    int num_drilled_ = 0;
+    std::uint64_t hash_ = 0;
+    int collected_b_ = 0;
+    int collected_f_ = 0;
+    int collected_l_ = 0;
+    int collected_r_ = 0;
+    int collected_c_ = 0;
+  };
+
+  Snapshot TakeSnapshot();
+  // Restores the state of |snapshot|, which must be taken from this Map or
+  // its copy. The undo log is cleared.
+  void Restore(const Snapshot& snapshot);
+
+  // Versioned binary image of the Map, including its Terrain, so that long
+  // solves can be resumed or forked without the .desc and the program so
+  // far. The undo log (and the undo limit) is included if |with_undo_log|.
+  // Optional structures (bitboard, components, distance field and trace)
+  // are not, and are off in the deserialized Map. The image is in the
+  // native byte order.
+  std::string Serialize(bool with_undo_log = false) const;
+  // Dies if |image| is malformed.
+  static Map Deserialize(absl::string_view image);
+
+  // Writes Serialize() to |path| by a single write(2), through a temporary
+  // file renamed over |path|, so that a process killed while saving leaves
+  // the previous file intact.
+  void Save(const std::string& path, bool with_undo_log = false) const;
+  static Map Load(const std::string& path);
+
   bool IsVisible(const Point& origin, const Point& target) const;
 
+  // Zobrist hash of the state: filled cells, remaining boosters, reset
+  // points, wrappers (position, manipulators and booster counters) and
+  // collected boosters. Maintained incrementally on Run() and Undo(), so
+  // that searches can detect transpositions in O(1). The number of steps is
+  // not included.
+  std::uint64_t hash() const;
+
+  // Starts maintaining a MineBitboard mirror of the grid, updated on every
+  // Run() and Undo(), for fast counting of empty cells. It is read-only and
+  // kept next to the byte grid, so it adds memory (about 45 KB for a
+  // 400x400 map) rather than replacing the grid. Off by default, as most
+  // solvers don't need it.
+  void EnableBitboard();
+  const MineBitboard* bitboard() const {
+    return bitboard_ ? &*bitboard_ : nullptr;
+  }
+
+  // Starts tracking connected components of EMPTY cells, updated on every
+  // Run() and Undo(). Off by default.
+  void EnableComponents();
+  const EmptyComponents* components() const {
+    return components_ ? &*components_ : nullptr;
+  }
+
+  // Starts maintaining the distance from every cell to the nearest EMPTY
+  // cell, updated on every Run() and Undo(). Off by default.
+  void EnableDistanceField();
+  const DistanceField* distance_field() const {
+    return distance_field_ ? &*distance_field_ : nullptr;
+  }
+
+  // Starts maintaining travel times counting teleports to the installed
+  // reset points, updated on every Run() and Undo(). Off by default.
+  void EnableTeleportDistances();
+  const TeleportDistances* teleport_distances() const {
+    return teleport_distances_ ? &*teleport_distances_ : nullptr;
+  }
+
   std::string ToString() const;
 
   int collectedB() const { return collected_b_; }
@@ -283,12 +566,25 @@ class Map {
   int collectedC() const { return collected_c_; }
   
  private:
+  // Row-major ID of a cell, for everything but |map_|.
   inline size_t Index(const Point& p) const {
     return p.y * width_ + p.x;
   }
+  // Position of a cell in |map_|.
+  inline size_t Slot(const Point& p) const {
+    return layout_.Slot(p.x, p.y);
+  }
   Cell& GetCell(const Point& p) {
-    return map_[Index(p)];
+    return map_[Slot(p)];
   }
+  // Whether |target| is visible from |origin| on the current grid.
+  bool Visible(const Point& origin, const Point& target) const;
+
+  // The grid in Index() order, for EmptyComponents, DistanceField and
+  // TeleportDistances.
+  const std::vector<Cell>& RowMajorCells();
+  // Builds |teleport_distances_| from scratch.
+  void ResetTeleportDistances();
   void Move(Wrapper* wrapper, const Point& direction,
             BacklogEntry* log_entry,
             BacklogEntry::Action a, BacklogEntry::Action aa);
@@ -296,17 +592,59 @@ class Map {
                     BacklogEntry* log_entry, bool is_first);
   RunResult DryMove(const Wrapper& wrapper, const Point& direction) const;
 
-  void Fill(const Wrapper& wrapper, BacklogEntry* entry);
-  void Unfill(const std::vector<std::pair<Point, Cell>>& cells);
+  void Fill(const Wrapper& wrapper, Backlog* backlog);
+  void Unfill(absl::Span<const Backlog::CellDelta> cells);
+
+  // Puts back the booster initially at |p|, which must have been taken.
+  void PutBackBooster(const Point& p);
+  void TakeBooster(const Point& p);
+
+  void SetResetPoint(const Point& p, bool value);
+
+  // Record of the last action of the |index|-th wrapper in this step.
+  TraceRecord MakeTraceRecord(int index, Instruction::Type type,
+                              int wrapped) const;
 
+  // Counter of collected |booster|s, or nullptr for X.
+  int* Collected(Booster booster);
+  // Gives pending boosters flushed by Step() since flushed_boosters_[begin]
+  // back to their wrappers.
+  void UnflushBoosters(int begin);
+
+  std::shared_ptr<const Terrain> terrain_;
   std::size_t width_;
   std::size_t height_;
+  CellLayout layout_;
+  // The grid in |layout_| order. Slots out of the map are WALL.
   std::vector<Cell> map_;
-  std::map<Point, Booster> booster_map_;
-  std::set<Point> resets_;
+  // Scratch space for RowMajorCells().
+  std::vector<Cell> row_major_cells_;
+
+  // Whether each booster of the terrain, by ID, is taken.
+  std::vector<std::uint8_t> taken_;
+  // Per-cell flags of reset points, indexed by Index(). Empty until the
+  // first one is installed, as most wrappings install none.
+  std::vector<std::uint8_t> resets_;
+  std::vector<Point> booster_points_;
+  std::vector<Point> reset_points_;
+
+  absl::optional<MineBitboard> bitboard_;
+  absl::optional<EmptyComponents> components_;
+  absl::optional<DistanceField> distance_field_;
+  absl::optional<TeleportDistances> teleport_distances_;
+
+  // Chunks of |map_| shared with snapshots. Chunk i equals
+  // *shared_chunks_[i] unless dirty_chunks_[i] is set.
+  std::vector<std::shared_ptr<const std::vector<Cell>>> shared_chunks_;
+  std::vector<std::uint8_t> dirty_chunks_;
 
   int num_steps_ = 0;
   int remaining_ = 0;
+  // Walls of the terrain drilled through, which Visible() can't take from
+  // Terrain::wall_window().
+  int num_drilled_ = 0;
+  // Everything of hash() but the collected boosters.
+  std::uint64_t hash_ = 0;
   std::vector<Wrapper> wrappers_;
 
   int collected_b_ = 0;
@@ -315,11 +653,46 @@ class Map {
   int collected_r_ = 0;
   int collected_c_ = 0;
 
-  // Maybe deque to limit num backtrackable for performance?
-  std::vector<BacklogEntry> backlogs_;
+  Backlog backlogs_;
+
+  // Undo log of Step(), beside |backlogs_|.
+  struct StepLog {
+    int num_actions;
+    int flushed_begin;  // Into |flushed_boosters_|.
+    int end;  // |num_steps_| after the step, to tell it from Run()s.
+  };
+  std::vector<StepLog> step_logs_;
+  // (wrapper index, booster) of pending boosters collected by Step().
+  std::vector<std::pair<int, Booster>> flushed_boosters_;
+
+  TraceWriter* trace_ = nullptr;
+  // Records of the step in progress, if tracing.
+  std::vector<TraceRecord> trace_records_;
 };
 
+std::ostream& operator<<(std::ostream& os, Map::RunResult result);
+
+// Outcome of running a whole Solution.
+struct VerifyResult {
+  bool success() const {
+    return failure == Map::RunResult::SUCCESS && remaining == 0;
+  }
+
+  // Time units run. On failure, the time step of the failed instruction.
+  int steps = 0;
+  int remaining = 0;
+  // Why and by which wrapper the first invalid instruction failed, if any.
+  Map::RunResult failure = Map::RunResult::SUCCESS;
+  int failed_wrapper = -1;
+};
+
+// Runs |sol| on |m|, stopping at the first invalid instruction.
+VerifyResult Simulate(Map* m, const Solution& sol);
+VerifyResult Simulate(Map* m, SolutionReader* sol);
+
+// Same as Simulate(), but prints the result.
 bool Verify(Map* m, const Solution& sol);
+bool Verify(Map* m, SolutionReader* sol);
 
 } // namespace icpfc2019
 
@@ -0,0 +1,244 @@
+#include "simulator.h"
+
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "mapped_file.h"
+
+DEFINE_string(data_dir, "",
+              "Root of the repository, containing problems/ and manual/. "
+              "Defaults to the workspace under `bazel run`, or the current "
+              "directory.");
+
+namespace icfpc2019 {
+namespace {
+
+// Small, medium and 400x400 maps.
+const char* const kProblems[] = {"prob-002", "prob-150", "prob-300"};
+// Problems with a stored solution in manual/.
+const char* const kSolved[] = {"prob-002", "prob-073", "prob-163"};
+
+std::string DataPath(const std::string& relative) {
+  std::string dir = FLAGS_data_dir;
+  if (dir.empty()) {
+    const char* workspace = std::getenv("BUILD_WORKSPACE_DIRECTORY");
+    dir = workspace ? workspace : ".";
+  }
+  return dir + "/" + relative;
+}
+
+Desc LoadDesc(const std::string& name) {
+  return ParseDesc(MappedFile(DataPath("problems/" + name + ".desc"))
+                       .contents());
+}
+
+const Instruction::Type kMoves[] = {
+  Instruction::Type::W, Instruction::Type::S,
+  Instruction::Type::A, Instruction::Type::D,
+};
+
+const std::vector<Instruction::Type> kWalkTypes = {
+  Instruction::Type::W, Instruction::Type::S,
+  Instruction::Type::A, Instruction::Type::D,
+  Instruction::Type::Q, Instruction::Type::E,
+};
+
+// Runs random successful |types| on wrapper 0, undoing them all every 256
+// of them. Each iteration is one Run(), plus one Undo() amortized.
+void RandomWalk(benchmark::State& state, Map* map,
+                const std::vector<Instruction::Type>& types = kWalkTypes) {
+  constexpr int kWalk = 256;
+  std::mt19937 rng(1);
+  int done = 0;
+  for (auto _ : state) {
+    while (map->Run(0, Instruction{types[rng() % types.size()]}) !=
+           Map::RunResult::SUCCESS) {
+    }
+    if (++done == kWalk) {
+      for (; done > 0; --done)
+        map->Undo();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_MapConstruction(benchmark::State& state, const Desc& desc) {
+  for (auto _ : state) {
+    Map map(desc);
+    benchmark::DoNotOptimize(map.remaining());
+  }
+}
+
+void BM_MapOnTerrain(benchmark::State& state, const Desc& desc) {
+  const auto terrain = std::make_shared<const Terrain>(desc);
+  for (auto _ : state) {
+    Map map(terrain);
+    benchmark::DoNotOptimize(map.remaining());
+  }
+}
+
+void BM_RunUndo(benchmark::State& state, const Desc& desc) {
+  Map map(desc);
+  RandomWalk(state, &map);
+}
+
+// As BM_RunUndo, but by a wrapper with |state.range(0)| extra manipulators,
+// so that Fill() dominates, walking along |types|. The B boosters are put
+// on a straight line from the start, picked up and attached before timing.
+void BM_RunUndoExtended(benchmark::State& state, Desc desc,
+                        const std::vector<Instruction::Type>& types) {
+  const int extra = state.range(0);
+  const Terrain terrain(desc);
+  auto is_empty = [&](const Point& p) {
+    return 0 <= p.x && p.x < terrain.width() &&
+        0 <= p.y && p.y < terrain.height() &&
+        terrain.cells()[p.y * terrain.width() + p.x] == Cell::EMPTY &&
+        terrain.booster_id(p.y * terrain.width() + p.x) ==
+            Terrain::kNoBooster;
+  };
+  const Point kDirections[] = {{0, 1}, {0, -1}, {-1, 0}, {1, 0}};
+  int direction = -1;
+  for (int i = 0; i < 4 && direction < 0; ++i) {
+    Point p = terrain.start();
+    int k = 0;
+    while (k < extra && is_empty(p + kDirections[i])) {
+      p = p + kDirections[i];
+      ++k;
+    }
+    if (k == extra)
+      direction = i;
+  }
+  if (direction < 0) {
+    state.SkipWithError("no room for the boosters around the start");
+    return;
+  }
+  Point p = terrain.start();
+  for (int i = 0; i < extra; ++i) {
+    p = p + kDirections[direction];
+    desc.boosters.push_back({p, Booster::B});
+  }
+
+  Map map(desc);
+  for (int i = 0; i < extra; ++i)
+    CHECK(map.Run(0, Instruction{kMoves[direction]}) ==
+          Map::RunResult::SUCCESS);
+  for (int i = 0; i < extra; ++i) {
+    const auto actions = map.LegalActions(0);
+    CHECK(!actions.manipulators.empty());
+    CHECK(map.Run(0, Instruction{Instruction::Type::B,
+                                 actions.manipulators.front()}) ==
+          Map::RunResult::SUCCESS);
+  }
+  const auto initial = map.TakeSnapshot();
+  map.Restore(initial);  // Drops the setup from the undo log.
+  RandomWalk(state, &map, types);
+}
+
+// IsVisible() from random empty cells to targets within |state.range(0)|
+// in both axes, as manipulators are checked.
+void BM_IsVisible(benchmark::State& state, const Desc& desc) {
+  const int range = state.range(0);
+  const Map map(desc);
+  std::vector<Point> origins;
+  for (int y = 0; y < map.height(); ++y) {
+    for (int x = 0; x < map.width(); ++x) {
+      if (map[Point{x, y}] != Cell::WALL)
+        origins.push_back(Point{x, y});
+    }
+  }
+  std::mt19937 rng(1);
+  constexpr int kPairs = 4096;
+  std::vector<std::pair<Point, Point>> pairs;
+  while (pairs.size() < kPairs) {
+    const Point origin = origins[rng() % origins.size()];
+    const Point target{origin.x + static_cast<int>(rng() % (2 * range + 1)) -
+                           range,
+                       origin.y + static_cast<int>(rng() % (2 * range + 1)) -
+                           range};
+    if (map.InMap(target))
+      pairs.emplace_back(origin, target);
+  }
+  std::size_t i = 0;
+  for (auto _ : state) {
+    const auto& pair = pairs[i++ % kPairs];
+    benchmark::DoNotOptimize(map.IsVisible(pair.first, pair.second));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Simulates a stored solution from the initial state, as the verifiers do.
+void BM_Simulate(benchmark::State& state, const std::string& name) {
+  Map map(LoadDesc(name));
+  const auto initial = map.TakeSnapshot();
+  const MappedFile file(DataPath("manual/" + name + ".sol"));
+  int steps = 0;
+  for (auto _ : state) {
+    map.Restore(initial);
+    SolutionReader sol(file.contents());
+    const auto result = Simulate(&map, &sol);
+    if (!result.success()) {
+      state.SkipWithError("the solution is invalid");
+      return;
+    }
+    steps = result.steps;
+  }
+  state.counters["steps"] = steps;
+  state.SetItemsProcessed(state.iterations() * steps);
+}
+
+}  // namespace
+}  // namespace icfpc2019
+
+// Benchmarks of the simulator hot paths on problems/ and manual/, so that
+// simulator changes can be compared before and after. Takes the usual
+// --benchmark_* flags, e.g. --benchmark_filter=RunUndo.
+int main(int argc, char* argv[]) {
+  benchmark::Initialize(&argc, argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  using namespace icfpc2019;
+  for (const char* name : kProblems) {
+    const Desc desc = LoadDesc(name);
+    benchmark::RegisterBenchmark(
+        (std::string("BM_MapConstruction/") + name).c_str(),
+        BM_MapConstruction, desc);
+    benchmark::RegisterBenchmark(
+        (std::string("BM_MapOnTerrain/") + name).c_str(),
+        BM_MapOnTerrain, desc);
+    benchmark::RegisterBenchmark(
+        (std::string("BM_RunUndo/") + name).c_str(), BM_RunUndo, desc);
+    benchmark::RegisterBenchmark(
+        (std::string("BM_RunUndoExtended/") + name).c_str(),
+        BM_RunUndoExtended, desc, kWalkTypes)->Arg(4)->Arg(8);
+    // The manipulators stick out along the first free direction from the
+    // start, so the walks along and across them touch different rows.
+    benchmark::RegisterBenchmark(
+        (std::string("BM_RunUndoExtendedWS/") + name).c_str(),
+        BM_RunUndoExtended, desc,
+        std::vector<Instruction::Type>{Instruction::Type::W,
+                                       Instruction::Type::S})->Arg(8);
+    benchmark::RegisterBenchmark(
+        (std::string("BM_RunUndoExtendedAD/") + name).c_str(),
+        BM_RunUndoExtended, desc,
+        std::vector<Instruction::Type>{Instruction::Type::A,
+                                       Instruction::Type::D})->Arg(8);
+    benchmark::RegisterBenchmark(
+        (std::string("BM_IsVisible/") + name).c_str(),
+        BM_IsVisible, desc)->Arg(2)->Arg(8);
+  }
+  for (const char* name : kSolved) {
+    benchmark::RegisterBenchmark(
+        (std::string("BM_Simulate/") + name).c_str(), BM_Simulate,
+        std::string(name));
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,1064 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mapped_file.h"
+#include "trace.h"
+#include "visibility.h"
+
+namespace icfpc2019 {
+namespace {
+
+// 20x10 room with a pillar, and some boosters.
+Desc MakeDesc() {
+  Desc desc;
+  desc.map_ = {{0, 0}, {20, 0}, {20, 10}, {0, 10}};
+  desc.point = {0, 0};
+  desc.obstacles = {{{8, 3}, {12, 3}, {12, 7}, {8, 7}}};
+  desc.boosters = {
+    {{2, 2}, Booster::B}, {{5, 1}, Booster::F}, {{15, 8}, Booster::L},
+    {{18, 1}, Booster::R}, {{3, 8}, Booster::X}, {{4, 8}, Booster::C},
+  };
+  return desc;
+}
+
+// Runs |n| random successful instructions on wrapper 0.
+void RandomWalk(Map* map, std::mt19937* rng, int n) {
+  const Instruction::Type kTypes[] = {
+    Instruction::Type::W, Instruction::Type::S,
+    Instruction::Type::A, Instruction::Type::D,
+    Instruction::Type::Q, Instruction::Type::E,
+    Instruction::Type::F, Instruction::Type::L,
+  };
+  while (n > 0) {
+    if (map->Run(0, Instruction{kTypes[(*rng)() % 8]}) ==
+        Map::RunResult::SUCCESS)
+      --n;
+  }
+}
+
+std::string Dump(const Map& map) {
+  return map.ToString() + std::to_string(map.remaining()) + " " +
+      std::to_string(map.num_steps());
+}
+
+TEST(SimulatorTest, RestoreToCheckpoint) {
+  Map map(MakeDesc());
+  std::mt19937 rng(1);
+  RandomWalk(&map, &rng, 10);
+  const auto checkpoint = map.Checkpoint();
+  const auto expected = Dump(map);
+  RandomWalk(&map, &rng, 50);
+  map.RestoreTo(checkpoint);
+  EXPECT_EQ(expected, Dump(map));
+  EXPECT_EQ(10, map.num_undoable());
+
+  // Steps are rolled back as a whole, including the boosters they flushed.
+  Desc desc;
+  desc.map_ = {{0, 0}, {6, 0}, {6, 6}, {0, 6}};
+  desc.point = {0, 0};
+  desc.boosters = {{{1, 0}, Booster::F}};
+  Map room(desc);
+  const Instruction d{Instruction::Type::D};
+  const Instruction w{Instruction::Type::W};
+  const auto start = room.Checkpoint();
+  const auto start_dump = Dump(room);
+  const auto start_hash = room.hash();
+  ASSERT_TRUE(room.Step({d}).ok());
+  const auto picked = room.Checkpoint();
+  const auto picked_dump = Dump(room);
+  const auto picked_hash = room.hash();
+  ASSERT_TRUE(room.Step({w}).ok());
+  EXPECT_EQ(1, room.collectedF());
+  // Mixed with plain Run()s.
+  ASSERT_EQ(Map::RunResult::SUCCESS, room.Run(0, w));
+  room.RestoreTo(picked);
+  EXPECT_EQ(picked_dump, Dump(room));
+  EXPECT_EQ(picked_hash, room.hash());
+  EXPECT_EQ(Booster::F, room.wrappers()[0].pending_booster());
+  EXPECT_EQ(0, room.collectedF());
+
+  ASSERT_TRUE(room.Step({w}).ok());
+  room.RestoreTo(start);
+  EXPECT_EQ(start_dump, Dump(room));
+  EXPECT_EQ(start_hash, room.hash());
+
+  // No step log is left behind.
+  ASSERT_TRUE(room.Step({w}).ok());
+  room.UndoStep();
+  EXPECT_EQ(start_dump, Dump(room));
+  EXPECT_EQ(start_hash, room.hash());
+  EXPECT_DEATH(room.UndoStep(), "No step to undo");
+}
+
+TEST(SimulatorTest, UndoLimit) {
+  Map map(MakeDesc());
+  map.set_undo_limit(5);
+  std::mt19937 rng(2);
+  RandomWalk(&map, &rng, 30);
+  EXPECT_EQ(5, map.num_undoable());
+
+  std::vector<std::string> history;
+  for (int i = 0; i < 20; ++i) {
+    history.push_back(Dump(map));
+    RandomWalk(&map, &rng, 1);
+  }
+  for (int i = 0; i < 5; ++i) {
+    map.Undo();
+    EXPECT_EQ(history[history.size() - 1 - i], Dump(map));
+  }
+  EXPECT_EQ(0, map.num_undoable());
+}
+
+TEST(SimulatorTest, Snapshot) {
+  Map map(MakeDesc());
+  std::mt19937 rng(3);
+  RandomWalk(&map, &rng, 20);
+  const auto snapshot = map.TakeSnapshot();
+  const auto expected = Dump(map);
+  EXPECT_EQ(map.remaining(), snapshot.remaining());
+
+  // Restore into the original and a copy which diverged differently.
+  Map fork = map;
+  RandomWalk(&map, &rng, 40);
+  RandomWalk(&fork, &rng, 70);
+  const auto forked = fork.TakeSnapshot();
+  const auto fork_expected = Dump(fork);
+
+  map.Restore(snapshot);
+  EXPECT_EQ(expected, Dump(map));
+  EXPECT_EQ(0, map.num_undoable());
+  map.Restore(forked);
+  EXPECT_EQ(fork_expected, Dump(map));
+  fork.Restore(snapshot);
+  EXPECT_EQ(expected, Dump(fork));
+
+  // Still fully functional after restoring.
+  RandomWalk(&fork, &rng, 10);
+  fork.RestoreTo(snapshot.num_steps());
+  EXPECT_EQ(expected, Dump(fork));
+}
+
+TEST(SimulatorTest, MapsShareTerrain) {
+  const auto terrain = std::make_shared<const Terrain>(MakeDesc());
+  Map map1(terrain);
+  Map map2(terrain);
+  EXPECT_EQ(Dump(Map(MakeDesc())), Dump(map1));
+  EXPECT_EQ(map1.hash(), Map(MakeDesc()).hash());
+
+  std::mt19937 rng(8);
+  RandomWalk(&map1, &rng, 100);
+  const auto walked = Dump(map1);
+  Map copy = map1;
+  EXPECT_EQ(terrain, copy.terrain());
+  RandomWalk(&copy, &rng, 100);
+  RandomWalk(&map2, &rng, 100);
+  EXPECT_EQ(walked, Dump(map1));
+  for (const auto& booster : terrain->boosters()) {
+    EXPECT_EQ(booster.second, Map(terrain).GetBooster(booster.first));
+  }
+}
+
+TEST(SimulatorTest, HashIsRestoredByUndo) {
+  Map map(MakeDesc());
+  std::mt19937 rng(4);
+  std::vector<std::uint64_t> hashes;
+  for (int i = 0; i < 100; ++i) {
+    hashes.push_back(map.hash());
+    RandomWalk(&map, &rng, 1);
+  }
+  for (int i = 99; i >= 0; --i) {
+    map.Undo();
+    EXPECT_EQ(hashes[i], map.hash()) << i;
+  }
+}
+
+TEST(SimulatorTest, HashDetectsTransposition) {
+  const Instruction q{Instruction::Type::Q};
+  const Instruction e{Instruction::Type::E};
+
+  // A full turn in either direction wraps the same cells.
+  Map map1(MakeDesc());
+  Map map2(MakeDesc());
+  for (int i = 0; i < 4; ++i) {
+    map1.Run(0, q);
+    map2.Run(0, e);
+  }
+  EXPECT_EQ(map1.hash(), map2.hash());
+
+  map1.Run(0, q);
+  EXPECT_NE(map1.hash(), map2.hash());
+  map2.Run(0, e);
+  EXPECT_NE(map1.hash(), map2.hash());
+  map2.Run(0, e);
+  map2.Run(0, e);
+  EXPECT_EQ(map1.hash(), map2.hash());
+}
+
+// Runs |program| (without B and T) on wrapper 0, one instruction at a time.
+void RunProgram(Map* map, const std::string& program) {
+  for (const char c : program) {
+    const Instruction inst = ParseSolution(std::string(1, c)).programs[0][0];
+    ASSERT_EQ(Map::RunResult::SUCCESS, map->Run(0, inst)) << c;
+  }
+}
+
+TEST(SimulatorTest, InstallResetPoint) {
+  Map map(MakeDesc());
+  const Instruction r{Instruction::Type::R};
+  EXPECT_EQ(Map::RunResult::NO_BOOSTER, map.DryRun(0, r));
+  // Pick up R at (18, 1), and install it on a cell without a booster.
+  RunProgram(&map, "DDDDDDDDDDDDDDDDDDWW");
+  EXPECT_EQ(1, map.collectedR());
+  const auto before = Dump(map);
+  const auto hash = map.hash();
+  ASSERT_EQ(Map::RunResult::SUCCESS, map.Run(0, r));
+  EXPECT_TRUE(map.IsResetPoint(Point{18, 2}));
+  EXPECT_EQ(std::vector<Point>{(Point{18, 2})}, map.reset_points());
+  // The booster is consumed.
+  EXPECT_EQ(0, map.collectedR());
+  EXPECT_EQ(Map::RunResult::NO_BOOSTER, map.DryRun(0, r));
+
+  map.Undo();
+  EXPECT_FALSE(map.IsResetPoint(Point{18, 2}));
+  EXPECT_TRUE(map.reset_points().empty());
+  EXPECT_EQ(before, Dump(map));
+  EXPECT_EQ(hash, map.hash());
+}
+
+TEST(SimulatorTest, CloneConsumesCloneBooster) {
+  auto desc = MakeDesc();
+  desc.boosters.push_back({{1, 0}, Booster::R});
+  Map map(desc);
+  const Instruction c{Instruction::Type::C};
+  // An R booster doesn't make a clone.
+  RunProgram(&map, "DA");
+  EXPECT_EQ(Map::RunResult::NO_BOOSTER, map.DryRun(0, c));
+
+  // Pick up C at (4, 8), and clone at X at (3, 8).
+  RunProgram(&map, "WWWWWWWWDDDDA");
+  ASSERT_EQ(Map::RunResult::SUCCESS, map.Run(0, c));
+  EXPECT_EQ(2u, map.wrappers().size());
+  EXPECT_EQ((Point{3, 8}), map.wrappers()[1].point());
+  EXPECT_EQ(0, map.collectedC());
+  EXPECT_EQ(1, map.collectedR());
+  EXPECT_EQ(Map::RunResult::NO_BOOSTER, map.DryRun(0, c));
+
+  map.Undo();
+  EXPECT_EQ(1u, map.wrappers().size());
+  EXPECT_EQ(1, map.collectedC());
+}
+
+TEST(SimulatorTest, UndoFastMove) {
+  Map map(MakeDesc());
+  // Pick up F at (5, 1), and speed up.
+  RunProgram(&map, "DDDDDWF");
+  const auto before = Dump(map);
+  const auto hash = map.hash();
+  const Instruction d{Instruction::Type::D};
+  ASSERT_EQ(Map::RunResult::SUCCESS, map.Run(0, d));
+  EXPECT_EQ((Point{7, 1}), map.wrappers()[0].point());
+  map.Undo();
+  EXPECT_EQ((Point{5, 1}), map.wrappers()[0].point());
+  EXPECT_EQ(before, Dump(map));
+  EXPECT_EQ(hash, map.hash());
+}
+
+// Dump() with the first wrapper's counters and pending booster.
+std::string DumpWithCounters(const Map& map) {
+  const auto& wrapper = map.wrappers()[0];
+  return Dump(map) + " " + std::to_string(wrapper.fast_count()) + " " +
+      std::to_string(wrapper.drill_count()) + " " +
+      std::to_string(static_cast<int>(wrapper.pending_booster())) + " " +
+      std::to_string(map.collectedF());
+}
+
+TEST(SimulatorTest, UndoRestoresWrapperExactly) {
+  Map map(MakeDesc());
+  // Onto F at (5, 1), which is pending until the next instruction.
+  RunProgram(&map, "DDDDDW");
+  ASSERT_EQ(Booster::F, map.wrappers()[0].pending_booster());
+
+  // F, then two fast moves onto cells wrapped by the manipulators already.
+  std::vector<std::string> history;
+  std::vector<int> remaining;
+  for (const char c : std::string("FDD")) {
+    history.push_back(DumpWithCounters(map));
+    remaining.push_back(map.remaining());
+    RunProgram(&map, std::string(1, c));
+  }
+  EXPECT_EQ((Point{9, 1}), map.wrappers()[0].point());
+  EXPECT_EQ(48, map.wrappers()[0].fast_count());
+
+  while (!history.empty()) {
+    map.Undo();
+    EXPECT_EQ(history.back(), DumpWithCounters(map));
+    EXPECT_EQ(remaining.back(), map.remaining());
+    history.pop_back();
+    remaining.pop_back();
+  }
+  EXPECT_EQ(Booster::F, map.wrappers()[0].pending_booster());
+  EXPECT_EQ(0, map.collectedF());
+}
+
+TEST(BacklogTest, PushAndPop) {
+  Backlog backlog;
+  EXPECT_TRUE(backlog.empty());
+  backlog.Push().set_fast_count(1);
+  backlog.AddCell(3, Cell::EMPTY);
+  backlog.AddCell(5, Cell::WALL);
+  backlog.Push().set_fast_count(2);
+  backlog.Push().set_fast_count(3);
+  backlog.AddCell(7, Cell::EMPTY);
+  ASSERT_EQ(3u, backlog.size());
+
+  EXPECT_EQ(3, backlog.back().fast_count());
+  ASSERT_EQ(1u, backlog.back_cells().size());
+  EXPECT_EQ(7u, Backlog::DeltaIndex(backlog.back_cells()[0]));
+  backlog.Pop();
+  EXPECT_EQ(2, backlog.back().fast_count());
+  EXPECT_TRUE(backlog.back_cells().empty());
+  backlog.Pop();
+  ASSERT_EQ(2u, backlog.back_cells().size());
+  EXPECT_EQ(3u, Backlog::DeltaIndex(backlog.back_cells()[0]));
+  EXPECT_EQ(Cell::EMPTY, Backlog::DeltaCell(backlog.back_cells()[0]));
+  EXPECT_EQ(5u, Backlog::DeltaIndex(backlog.back_cells()[1]));
+  EXPECT_EQ(Cell::WALL, Backlog::DeltaCell(backlog.back_cells()[1]));
+  backlog.Pop();
+  EXPECT_TRUE(backlog.empty());
+}
+
+TEST(BacklogTest, LimitDropsAndCompacts) {
+  Backlog backlog;
+  backlog.set_limit(3);
+  // Entry i updates i cells, at i * 100 + j.
+  for (int i = 0; i < 20; ++i) {
+    backlog.Push().set_fast_count(i);
+    for (int j = 0; j < i; ++j) {
+      backlog.AddCell(i * 100 + j, Cell::EMPTY);
+    }
+    EXPECT_EQ(std::min(i + 1, 3), static_cast<int>(backlog.size()));
+  }
+  for (int i = 19; i >= 17; --i) {
+    EXPECT_EQ(i, backlog.back().fast_count());
+    const auto cells = backlog.back_cells();
+    ASSERT_EQ(static_cast<std::size_t>(i), cells.size());
+    for (int j = 0; j < i; ++j) {
+      EXPECT_EQ(static_cast<std::size_t>(i * 100 + j),
+                Backlog::DeltaIndex(cells[j]));
+    }
+    backlog.Pop();
+  }
+  EXPECT_TRUE(backlog.empty());
+
+  // Shrinking the limit drops the oldest entries.
+  backlog.set_limit(0);
+  for (int i = 0; i < 5; ++i) {
+    backlog.Push().set_fast_count(i);
+  }
+  backlog.set_limit(2);
+  EXPECT_EQ(2u, backlog.size());
+  EXPECT_EQ(4, backlog.back().fast_count());
+  backlog.Pop();
+  EXPECT_EQ(3, backlog.back().fast_count());
+}
+
+TEST(SimulatorTest, ParseSolution) {
+  const auto sol = ParseSolution("WB(-1,12)D#T(3,4)C\n#\n");
+  ASSERT_EQ(3u, sol.programs.size());
+  ASSERT_EQ(3u, sol.programs[0].size());
+  EXPECT_EQ(Instruction::Type::B, sol.programs[0][1].type);
+  EXPECT_EQ(Point({-1, 12}), sol.programs[0][1].arg);
+  ASSERT_EQ(2u, sol.programs[1].size());
+  EXPECT_EQ(Point({3, 4}), sol.programs[1][0].arg);
+  EXPECT_EQ(Instruction::Type::C, sol.programs[1][1].type);
+  EXPECT_TRUE(sol.programs[2].empty());
+
+  std::ostringstream os;
+  os << sol;
+  EXPECT_EQ("WB(-1,12)D#T(3,4)C#", os.str());
+}
+
+TEST(SimulatorTest, SimulateReaderMatchesSolution) {
+  const std::string text = "DDWWQB(1,2)DDDWWWWWQEAAA\n";
+  Map map1(MakeDesc());
+  const auto result1 = Simulate(&map1, ParseSolution(text));
+  Map map2(MakeDesc());
+  SolutionReader reader(text);
+  const auto result2 = Simulate(&map2, &reader);
+  EXPECT_EQ(Map::RunResult::SUCCESS, result1.failure);
+  EXPECT_EQ(19, result1.steps);
+  EXPECT_EQ(result1.steps, result2.steps);
+  EXPECT_EQ(result1.remaining, result2.remaining);
+  EXPECT_EQ(Dump(map1), Dump(map2));
+}
+
+TEST(SimulatorTest, StepAndUndoStep) {
+  // Pick up C on the way to X, and clone there.
+  Map map(MakeDesc());
+  for (const char c : std::string("WWWWWWWWDDDDA")) {
+    const Instruction inst = ParseSolution(std::string(1, c)).programs[0][0];
+    ASSERT_TRUE(map.Step({inst}).ok()) << c;
+  }
+  const Instruction clone{Instruction::Type::C};
+  ASSERT_TRUE(map.Step({clone}).ok());
+  ASSERT_EQ(2u, map.wrappers().size());
+
+  // A failed step is rolled back, and a clone can't act in the step it was
+  // made.
+  const auto before = Dump(map);
+  const auto hash = map.hash();
+  const Instruction w{Instruction::Type::W};
+  const Instruction s{Instruction::Type::S};
+  const Instruction b{Instruction::Type::B, Point{1, 2}};
+  const auto no_booster = map.Step({s, b});
+  EXPECT_EQ(1, no_booster.failed_wrapper);
+  EXPECT_EQ(Map::RunResult::NO_BOOSTER, no_booster.failure);
+  const auto failed = map.Step({w, s, s});
+  EXPECT_EQ(2, failed.failed_wrapper);
+  EXPECT_EQ(Map::RunResult::NO_WRAPPER, failed.failure);
+  EXPECT_EQ(before, Dump(map));
+  EXPECT_EQ(hash, map.hash());
+
+  const Instruction::Type kTypes[] = {
+    Instruction::Type::W, Instruction::Type::S, Instruction::Type::A,
+    Instruction::Type::D, Instruction::Type::Q, Instruction::Type::E,
+    Instruction::Type::Z, Instruction::Type::F, Instruction::Type::L,
+  };
+  std::mt19937 rng(9);
+  std::vector<std::pair<std::string, std::uint64_t>> history;
+  while (history.size() < 50) {
+    const std::string dump = Dump(map);
+    const auto hash = map.hash();
+    const Instruction insts[] = {
+      Instruction{kTypes[rng() % 9]}, Instruction{kTypes[rng() % 9]},
+    };
+    if (map.Step(insts).ok()) {
+      history.emplace_back(dump, hash);
+    } else {
+      ASSERT_EQ(dump, Dump(map));
+      ASSERT_EQ(hash, map.hash());
+    }
+  }
+  while (!history.empty()) {
+    map.UndoStep();
+    EXPECT_EQ(history.back().first, Dump(map));
+    EXPECT_EQ(history.back().second, map.hash());
+    history.pop_back();
+  }
+}
+
+// Checks map.LegalActions() of every wrapper against DryRun().
+void ExpectLegalActionsConsistent(const Map& map) {
+  for (int i = 0; i < static_cast<int>(map.wrappers().size()); ++i) {
+    const auto actions = map.LegalActions(i);
+    for (int t = 0; t <= static_cast<int>(Instruction::Type::C); ++t) {
+      const auto type = static_cast<Instruction::Type>(t);
+      if (type == Instruction::Type::B || type == Instruction::Type::T)
+        continue;
+      EXPECT_EQ(map.DryRun(i, Instruction{type}) == Map::RunResult::SUCCESS,
+                actions.Has(type)) << type;
+    }
+
+    std::vector<Point> manipulators, teleports;
+    for (int y = -6; y <= 6; ++y) {
+      for (int x = -6; x <= 6; ++x) {
+        const Point d{x, y};
+        if (map.DryRun(i, Instruction{Instruction::Type::B, d}) ==
+            Map::RunResult::SUCCESS)
+          manipulators.push_back(d);
+      }
+    }
+    for (int y = 0; y < map.height(); ++y) {
+      for (int x = 0; x < map.width(); ++x) {
+        const Point p{x, y};
+        if (map.DryRun(i, Instruction{Instruction::Type::T, p}) ==
+            Map::RunResult::SUCCESS)
+          teleports.push_back(p);
+      }
+    }
+    auto sorted = [](std::vector<Point> points) {
+      std::sort(points.begin(), points.end());
+      return points;
+    };
+    EXPECT_EQ(sorted(manipulators), sorted(actions.manipulators));
+    EXPECT_EQ(!manipulators.empty(), actions.Has(Instruction::Type::B));
+    EXPECT_EQ(sorted(teleports), sorted(actions.teleports));
+    EXPECT_EQ(!teleports.empty(), actions.Has(Instruction::Type::T));
+  }
+}
+
+TEST(SimulatorTest, LegalActions) {
+  // More boosters near the start, to cover them all.
+  auto desc = MakeDesc();
+  desc.boosters.push_back({{1, 0}, Booster::R});
+  desc.boosters.push_back({{0, 1}, Booster::C});
+  desc.boosters.push_back({{1, 1}, Booster::L});
+  desc.boosters.push_back({{2, 0}, Booster::R});
+  desc.boosters.push_back({{0, 2}, Booster::C});
+  desc.boosters.push_back({{2, 1}, Booster::X});
+  Map map(desc);
+  std::mt19937 rng(10);
+  int used[static_cast<int>(Instruction::Type::C) + 1] = {};
+  for (int i = 0; i < 400; ++i) {
+    ExpectLegalActionsConsistent(map);
+    // Random legal instructions of every wrapper, to use up all boosters.
+    for (int w = 0; w < static_cast<int>(map.wrappers().size()); ++w) {
+      const auto actions = map.LegalActions(w);
+      // Prefer boosters, to cover them all.
+      std::vector<Instruction::Type> types;
+      for (int t = 0; t <= static_cast<int>(Instruction::Type::C); ++t) {
+        const auto type = static_cast<Instruction::Type>(t);
+        if (actions.Has(type) && t >= static_cast<int>(Instruction::Type::B) &&
+            type != Instruction::Type::T)
+          types.push_back(type);
+      }
+      if (types.empty() || rng() % 2) {
+        types.clear();
+        for (int t = 0; t <= static_cast<int>(Instruction::Type::C); ++t) {
+          if (actions.Has(static_cast<Instruction::Type>(t)))
+            types.push_back(static_cast<Instruction::Type>(t));
+        }
+      }
+      Instruction inst{types[rng() % types.size()]};
+      if (inst.type == Instruction::Type::B)
+        inst.arg = actions.manipulators[rng() % actions.manipulators.size()];
+      if (inst.type == Instruction::Type::T)
+        inst.arg = actions.teleports[rng() % actions.teleports.size()];
+      ASSERT_EQ(Map::RunResult::SUCCESS, map.Run(w, inst)) << inst;
+      ++used[static_cast<int>(inst.type)];
+    }
+  }
+  for (const auto type : {Instruction::Type::B, Instruction::Type::F,
+                          Instruction::Type::L, Instruction::Type::R,
+                          Instruction::Type::T, Instruction::Type::C}) {
+    EXPECT_GT(used[static_cast<int>(type)], 0) << type;
+  }
+}
+
+TEST(SimulatorTest, SimulateReportsFirstFailure) {
+  // Walks up to (7, 3), then into the pillar.
+  Map map(MakeDesc());
+  auto result = Simulate(&map, ParseSolution("DDDDDDDWWWDS"));
+  EXPECT_FALSE(result.success());
+  EXPECT_EQ(Map::RunResult::WALL, result.failure);
+  EXPECT_EQ(0, result.failed_wrapper);
+  EXPECT_EQ(10, result.steps);
+
+  Map map2(MakeDesc());
+  result = Simulate(&map2, ParseSolution("DDW"));
+  EXPECT_FALSE(result.success());
+  EXPECT_EQ(Map::RunResult::SUCCESS, result.failure);
+  EXPECT_EQ(3, result.steps);
+  EXPECT_EQ(map2.remaining(), result.remaining);
+}
+
+TEST(SimulatorTest, SimulateReportsMalformedInstruction) {
+  for (const std::string text : {"DDX", "DDB(1,", "DDT(1 2)", "DDB(,1)"}) {
+    Map map(MakeDesc());
+    SolutionReader reader(text);
+    const auto result = Simulate(&map, &reader);
+    EXPECT_EQ(Map::RunResult::UNKNOWN_INSTRUCTION, result.failure) << text;
+    EXPECT_EQ(0, result.failed_wrapper) << text;
+    EXPECT_EQ(2, result.steps) << text;
+  }
+
+  ProgramReader reader("WX");
+  Instruction inst;
+  ASSERT_TRUE(reader.TryNext(&inst));
+  EXPECT_EQ(Instruction::Type::W, inst.type);
+  EXPECT_FALSE(reader.TryNext(&inst));
+  EXPECT_EQ("Unknown instruction: X at 1", reader.error());
+}
+
+TEST(SimulatorTest, SimulateRejectsOutOfRangeArgument) {
+  for (const std::string text : {"DDB(4294967298,0)", "DDT(99999999999,1)",
+                                 "DDB(1,-2147483649)"}) {
+    Map map(MakeDesc());
+    SolutionReader reader(text);
+    const auto result = Simulate(&map, &reader);
+    EXPECT_EQ(Map::RunResult::UNKNOWN_INSTRUCTION, result.failure) << text;
+    EXPECT_EQ(2, result.steps) << text;
+  }
+
+  ProgramReader reader("B(2147483647,-2147483648)T(2147483648,0)");
+  Instruction inst;
+  ASSERT_TRUE(reader.TryNext(&inst));
+  EXPECT_EQ(Point({2147483647, -2147483648}), inst.arg);
+  EXPECT_FALSE(reader.TryNext(&inst));
+  EXPECT_EQ("Number out of range at 27", reader.error());
+}
+
+TEST(SimulatorTest, TryOpenMissingFile) {
+  EXPECT_FALSE(MappedFile::TryOpen(testing::TempDir() + "/no_such_file"));
+  const std::string path = testing::TempDir() + "/simulator_test.sol";
+  { std::ofstream(path) << "WD"; }
+  const auto file = MappedFile::TryOpen(path);
+  ASSERT_TRUE(file);
+  EXPECT_EQ("WD", file->contents());
+}
+
+// Checks map.IsVisible() against walking CrossedCells() on the grid.
+void ExpectVisibilityConsistent(const Map& map) {
+  for (int y = 0; y < map.height(); ++y) {
+    for (int x = 0; x < map.width(); ++x) {
+      const Point origin{x, y};
+      for (int dy = -3; dy <= 3; ++dy) {
+        for (int dx = -3; dx <= 3; ++dx) {
+          bool visible = true;
+          for (const auto& cell : CrossedCells(Point{dx, dy})) {
+            const Point p = origin + cell;
+            visible = visible && map.InMap(p) && map[p] != Cell::WALL;
+          }
+          ASSERT_EQ(visible, map.IsVisible(origin, origin + Point{dx, dy}))
+              << origin << " " << dx << " " << dy;
+        }
+      }
+    }
+  }
+}
+
+TEST(SimulatorTest, IsVisibleFollowsDrilling) {
+  Map map(MakeDesc());
+  ExpectVisibilityConsistent(map);
+  // Picks up L, and drills into the pillar.
+  for (const char c : std::string("WWWWWWWWDDDDDDDDDDDDDDDLAAAAASSS")) {
+    ASSERT_EQ(Map::RunResult::SUCCESS,
+              map.Run(0, ParseSolution(std::string(1, c)).programs[0][0]))
+        << c;
+  }
+  EXPECT_EQ(Cell::FILLED, (map[Point{10, 5}]));
+  ExpectVisibilityConsistent(map);
+  for (int i = 0; i < 3; ++i) {
+    map.Undo();
+  }
+  ExpectVisibilityConsistent(map);
+}
+
+TEST(SimulatorTest, Trace) {
+  // Picks up C, clones at X, and the clone moves once.
+  const std::string path = testing::TempDir() + "/simulator_test.trace";
+  Map map(MakeDesc());
+  const int initial_remaining = map.remaining();
+  {
+    TraceWriter writer(path, map.width(), map.height());
+    map.set_trace(&writer);
+    ASSERT_TRUE(
+        Simulate(&map, ParseSolution("WWWWWWWWDDDDACDD#S")).failure ==
+        Map::RunResult::SUCCESS);
+    // Failed steps are not recorded.
+    EXPECT_FALSE(map.Step({Instruction{Instruction::Type::B, {1, 1}}}).ok());
+    map.set_trace(nullptr);
+  }
+
+  const MappedFile file(path);
+  const TraceReader trace(file.contents());
+  EXPECT_EQ(map.width(), trace.width());
+  EXPECT_EQ(map.height(), trace.height());
+  const auto records = trace.records();
+  ASSERT_EQ(18u, records.size());
+
+  int wrapped = 0;
+  for (const auto& record : records) {
+    wrapped += record.wrapped;
+  }
+  EXPECT_EQ(initial_remaining - map.remaining(), wrapped);
+
+  EXPECT_EQ(11, records[11].step);
+  EXPECT_EQ(Booster::C, static_cast<Booster>(records[11].picked));
+  EXPECT_EQ(Booster::X, static_cast<Booster>(records[12].picked));
+  EXPECT_EQ(Instruction::Type::C,
+            static_cast<Instruction::Type>(records[13].instruction));
+
+  // The clone moves in step 14, and idles in step 15.
+  EXPECT_EQ(14, records[15].step);
+  EXPECT_EQ(1, records[15].wrapper);
+  EXPECT_EQ(Instruction::Type::S,
+            static_cast<Instruction::Type>(records[15].instruction));
+  const auto& last = records[17];
+  EXPECT_EQ(15, last.step);
+  EXPECT_EQ(1, last.wrapper);
+  EXPECT_EQ(Instruction::Type::Z,
+            static_cast<Instruction::Type>(last.instruction));
+  EXPECT_EQ(0, last.wrapped);
+  EXPECT_EQ(map.remaining(), last.remaining);
+  EXPECT_EQ(map.wrappers()[1].point(), (Point{last.x, last.y}));
+  EXPECT_EQ(map.wrappers()[0].point(), (Point{records[16].x, records[16].y}));
+}
+
+void ExpectSameState(const Map& expected, const Map& actual) {
+  EXPECT_EQ(Dump(expected), Dump(actual));
+  EXPECT_EQ(expected.hash(), actual.hash());
+  ASSERT_EQ(expected.wrappers().size(), actual.wrappers().size());
+  for (std::size_t i = 0; i < expected.wrappers().size(); ++i) {
+    const auto& a = expected.wrappers()[i];
+    const auto& b = actual.wrappers()[i];
+    EXPECT_EQ(a.point(), b.point()) << i;
+    EXPECT_EQ(a.manipulators(), b.manipulators()) << i;
+    EXPECT_EQ(a.fast_count(), b.fast_count()) << i;
+    EXPECT_EQ(a.drill_count(), b.drill_count()) << i;
+    EXPECT_EQ(a.pending_booster(), b.pending_booster()) << i;
+  }
+  EXPECT_EQ(expected.collectedB(), actual.collectedB());
+  EXPECT_EQ(expected.collectedF(), actual.collectedF());
+  EXPECT_EQ(expected.collectedL(), actual.collectedL());
+  EXPECT_EQ(expected.collectedR(), actual.collectedR());
+  EXPECT_EQ(expected.collectedC(), actual.collectedC());
+}
+
+TEST(SimulatorTest, SerializeRoundTrip) {
+  Map map(MakeDesc());
+  ASSERT_TRUE(Simulate(&map, ParseSolution("WWWWWWWWDDDDACDD#S")).failure ==
+              Map::RunResult::SUCCESS);
+  const auto image = map.Serialize();
+  ExpectSameState(map, Map::Deserialize(image));
+  EXPECT_EQ(0, Map::Deserialize(image).num_undoable());
+
+  // With the undo log, the loaded map can go back to the start.
+  const std::string path = testing::TempDir() + "/simulator_test.map";
+  map.Save(path, /*with_undo_log=*/true);
+  Map loaded = Map::Load(path);
+  ExpectSameState(map, loaded);
+  ASSERT_EQ(map.num_undoable(), loaded.num_undoable());
+  for (int i = 0; i < 16; ++i) {
+    map.UndoStep();
+    loaded.UndoStep();
+    ExpectSameState(map, loaded);
+  }
+  ExpectSameState(Map(MakeDesc()), loaded);
+
+  // And carry on like the original.
+  std::mt19937 rng1(9), rng2(9);
+  RandomWalk(&map, &rng1, 30);
+  RandomWalk(&loaded, &rng2, 30);
+  ExpectSameState(map, loaded);
+}
+
+template <typename T>
+T PeekImage(const std::string& image, std::size_t offset) {
+  T value;
+  std::memcpy(&value, image.data() + offset, sizeof(T));
+  return value;
+}
+
+template <typename T>
+std::string PatchImage(std::string image, std::size_t offset, T value) {
+  std::memcpy(&image[offset], &value, sizeof(T));
+  return image;
+}
+
+TEST(SimulatorTest, DeserializeRejectsCorruptImage) {
+  Map map(MakeDesc());
+  ASSERT_TRUE(Simulate(&map, ParseSolution("WWWWWWWWDDDDACDD#S")).failure ==
+              Map::RunResult::SUCCESS);
+  const auto image = map.Serialize();
+  const auto full_image = map.Serialize(/*with_undo_log=*/true);
+  // Both start alike but for the flags, and the undo log follows.
+  ASSERT_EQ(image.substr(16), full_image.substr(16, image.size() - 16));
+
+  // Magic, version, flags, width, height, start, number of cells.
+  const std::size_t first_cell = 8 + 4 + 4 + 4 + 4 + sizeof(Point) + 4;
+  EXPECT_DEATH(Map::Deserialize(PatchImage<std::uint8_t>(image, first_cell, 3)),
+               "Bad cell");
+  // Followed by the counters: remaining, drilled, hash and collected ones.
+  const std::size_t remaining = image.size() - 5 * 4 - 8 - 4 - 4;
+  ASSERT_EQ(map.remaining(), PeekImage<std::int32_t>(image, remaining));
+  EXPECT_DEATH(Map::Deserialize(
+                   PatchImage<std::int32_t>(image, remaining,
+                                            map.remaining() - 1)),
+               "Inconsistent remaining cells");
+
+  // Undo log: limit, then entries, cell deltas and step logs.
+  const std::size_t num_entries =
+      PeekImage<std::uint32_t>(full_image, image.size() + 8);
+  ASSERT_EQ(map.num_undoable(), static_cast<int>(num_entries));
+  const std::size_t entries = image.size() + 8 + 4;
+  const auto last_entry = entries + (num_entries - 1) * sizeof(BacklogEntry);
+  // wrapper_index follows cells_begin and the original position.
+  EXPECT_DEATH(Map::Deserialize(
+                   PatchImage<std::uint16_t>(full_image, last_entry + 8, 7)),
+               "unknown wrapper");
+  EXPECT_DEATH(Map::Deserialize(PatchImage(
+                   full_image, last_entry,
+                   PeekImage<std::uint32_t>(full_image, entries))),
+               "out of order");
+  const std::size_t num_deltas = PeekImage<std::uint32_t>(
+      full_image, entries + num_entries * sizeof(BacklogEntry));
+  const std::size_t first_step_log =
+      entries + num_entries * sizeof(BacklogEntry) + 4 +
+      num_deltas * sizeof(Backlog::CellDelta) + 4;
+  EXPECT_DEATH(Map::Deserialize(PatchImage<std::int32_t>(
+                   full_image, first_step_log, num_entries + 1)),
+               "Bad step log");
+  const std::size_t last_step_log =
+      first_step_log +
+      (PeekImage<std::uint32_t>(full_image, first_step_log - 4) - 1) *
+          3 * sizeof(std::int32_t);
+  EXPECT_DEATH(Map::Deserialize(PatchImage<std::int32_t>(
+                   full_image, last_step_log + 4, 100)),
+               "unknown flushed boosters");
+}
+
+// Checks map.components() against a flood fill from scratch.
+void ExpectComponentsConsistent(const Map& map) {
+  const auto* components = map.components();
+  std::vector<int> seen(map.width() * map.height(), -1);
+  std::vector<int> sizes;
+  for (int y = 0; y < map.height(); ++y) {
+    for (int x = 0; x < map.width(); ++x) {
+      if (map[Point{x, y}] != Cell::EMPTY || seen[y * map.width() + x] >= 0)
+        continue;
+      const int id = components->id(Point{x, y});
+      std::vector<Point> queue = {{x, y}};
+      seen[y * map.width() + x] = id;
+      for (std::size_t head = 0; head < queue.size(); ++head) {
+        const Point p = queue[head];
+        ASSERT_EQ(id, components->id(p)) << p;
+        for (const Point d : {Point{1, 0}, Point{-1, 0},
+                              Point{0, 1}, Point{0, -1}}) {
+          const Point q = p + d;
+          if (map.InMap(q) && map[q] == Cell::EMPTY &&
+              seen[q.y * map.width() + q.x] < 0) {
+            seen[q.y * map.width() + q.x] = id;
+            queue.push_back(q);
+          }
+        }
+      }
+      EXPECT_EQ(static_cast<int>(queue.size()), components->size(id));
+      EXPECT_EQ(id, components->id(components->representative(id)));
+      sizes.push_back(queue.size());
+    }
+  }
+  EXPECT_EQ(static_cast<int>(sizes.size()), components->count());
+}
+
+TEST(SimulatorTest, ComponentsFollowRunAndUndo) {
+  // Narrow corridors, so that wrapping splits the empty area often.
+  Desc desc;
+  desc.map_ = {{0, 0}, {12, 0}, {12, 9}, {0, 9}};
+  desc.point = {0, 0};
+  desc.obstacles = {
+    {{2, 1}, {10, 1}, {10, 2}, {2, 2}},
+    {{2, 3}, {10, 3}, {10, 4}, {2, 4}},
+    {{2, 5}, {3, 5}, {3, 8}, {2, 8}},
+    {{5, 5}, {6, 5}, {6, 8}, {5, 8}},
+  };
+  Map map(desc);
+  map.EnableComponents();
+  ExpectComponentsConsistent(map);
+
+  std::mt19937 rng(5);
+  for (int i = 0; i < 300; ++i) {
+    if (rng() % 4 == 0 && map.num_undoable() > 0) {
+      map.Undo();
+    } else {
+      RandomWalk(&map, &rng, 1);
+    }
+    ExpectComponentsConsistent(map);
+  }
+}
+
+// Checks map.distance_field() against a BFS from scratch.
+void ExpectDistanceFieldConsistent(const Map& map) {
+  const auto* field = map.distance_field();
+  const int width = map.width();
+  std::vector<std::int32_t> dist(width * map.height(),
+                                 DistanceField::kUnreachable);
+  std::vector<Point> queue;
+  for (int y = 0; y < map.height(); ++y) {
+    for (int x = 0; x < width; ++x) {
+      if (map[Point{x, y}] == Cell::EMPTY) {
+        dist[y * width + x] = 0;
+        queue.push_back(Point{x, y});
+      }
+    }
+  }
+  const Point kDirs[] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  const Point kNone{0, 0};
+  for (std::size_t head = 0; head < queue.size(); ++head) {
+    const Point p = queue[head];
+    for (const Point d : kDirs) {
+      const Point q = p + d;
+      if (map.InMap(q) && map[q] != Cell::WALL &&
+          dist[q.y * width + q.x] == DistanceField::kUnreachable) {
+        dist[q.y * width + q.x] = dist[p.y * width + p.x] + 1;
+        queue.push_back(q);
+      }
+    }
+  }
+  for (int y = 0; y < map.height(); ++y) {
+    for (int x = 0; x < width; ++x) {
+      const Point p{x, y};
+      const auto expected = dist[y * width + x];
+      ASSERT_EQ(expected, field->Distance(p)) << p;
+      const Point step = field->FirstStep(p);
+      if (expected == 0 || expected == DistanceField::kUnreachable) {
+        EXPECT_EQ(kNone, step) << p;
+      } else {
+        const Point q = p + step;
+        ASSERT_TRUE(map.InMap(q)) << p;
+        EXPECT_EQ(expected - 1, dist[q.y * width + q.x]) << p;
+      }
+    }
+  }
+}
+
+TEST(SimulatorTest, DistanceFieldFollowsRunAndUndo) {
+  Map map(MakeDesc());
+  map.EnableDistanceField();
+  ExpectDistanceFieldConsistent(map);
+
+  // Long enough to pick up the drill and walk through the pillar.
+  std::mt19937 rng(6);
+  for (int i = 0; i < 500; ++i) {
+    if (rng() % 4 == 0 && map.num_undoable() > 0) {
+      map.Undo();
+    } else {
+      RandomWalk(&map, &rng, 1 + rng() % 3);
+    }
+    if (i % 3 == 0)
+      ExpectDistanceFieldConsistent(map);
+  }
+
+  const auto snapshot = map.TakeSnapshot();
+  RandomWalk(&map, &rng, 30);
+  map.Restore(snapshot);
+  ExpectDistanceFieldConsistent(map);
+}
+
+// Walking distances from |source| on the current grid, by Index().
+std::vector<std::int32_t> WalkingDistances(const Map& map,
+                                           const Point& source) {
+  const int width = map.width();
+  std::vector<std::int32_t> dist(width * map.height(),
+                                 TeleportDistances::kUnreachable);
+  dist[source.y * width + source.x] = 0;
+  std::vector<Point> queue = {source};
+  const Point kDirs[] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+  for (std::size_t head = 0; head < queue.size(); ++head) {
+    const Point p = queue[head];
+    for (const Point d : kDirs) {
+      const Point q = p + d;
+      if (map.InMap(q) && map[q] != Cell::WALL &&
+          dist[q.y * width + q.x] == TeleportDistances::kUnreachable) {
+        dist[q.y * width + q.x] = dist[p.y * width + p.x] + 1;
+        queue.push_back(q);
+      }
+    }
+  }
+  return dist;
+}
+
+// Checks map.teleport_distances() from the wrappers against BFS from
+// scratch.
+void ExpectTeleportDistancesConsistent(const Map& map) {
+  const auto* distances = map.teleport_distances();
+  const int width = map.width();
+  std::vector<std::int32_t> beacon(width * map.height(),
+                                   TeleportDistances::kUnreachable);
+  for (const auto& r : map.reset_points()) {
+    const auto walk = WalkingDistances(map, r);
+    for (std::size_t i = 0; i < beacon.size(); ++i) {
+      beacon[i] = std::min(beacon[i], walk[i]);
+    }
+  }
+  std::vector<std::int32_t> result;
+  for (const auto& wrapper : map.wrappers()) {
+    const Point s = wrapper.point();
+    const auto walk = WalkingDistances(map, s);
+    distances->DistancesFrom(s, &result);
+    for (int y = 0; y < map.height(); ++y) {
+      for (int x = 0; x < width; ++x) {
+        const Point t{x, y};
+        const int i = y * width + x;
+        ASSERT_EQ(beacon[i], distances->beacon_distance(t)) << t;
+        const auto expected = beacon[i] == TeleportDistances::kUnreachable
+            ? walk[i] : std::min(walk[i], beacon[i] + 1);
+        ASSERT_EQ(expected, result[i]) << s << " to " << t;
+        ASSERT_EQ(expected, distances->Distance(s, t)) << s << " to " << t;
+      }
+    }
+  }
+}
+
+TEST(SimulatorTest, TeleportDistancesFollowRunAndUndo) {
+  auto desc = MakeDesc();
+  desc.boosters.emplace_back(Point{1, 5}, Booster::R);
+  desc.boosters.emplace_back(Point{7, 1}, Booster::R);
+  Map map(desc);
+  map.EnableTeleportDistances();
+  ExpectTeleportDistancesConsistent(map);
+
+  // A reset point removed by its log.
+  ASSERT_TRUE(Simulate(&map, ParseSolution("WWWWWDR")).failure ==
+              Map::RunResult::SUCCESS);
+  ExpectTeleportDistancesConsistent(map);
+  for (int i = 0; i < 7; ++i) {
+    map.UndoStep();
+    ExpectTeleportDistancesConsistent(map);
+  }
+
+  // Installs reset points at (1, 5) and (8, 1), then drills through the
+  // pillar from (15, 5).
+  const std::string kPrefix =
+      "WWWWWDRSSSSDDDDDDDRDDDDDDDWWWWWWWSSSLAAAAAAA";
+  ASSERT_TRUE(Simulate(&map, ParseSolution(kPrefix)).failure ==
+              Map::RunResult::SUCCESS);
+  ASSERT_EQ(2u, map.reset_points().size());
+  ASSERT_EQ(Cell::FILLED, (map[Point{10, 5}]));
+  ExpectTeleportDistancesConsistent(map);
+
+  // Also drills through the pillar, and installs and teleports to reset
+  // points.
+  const Instruction::Type kTypes[] = {
+    Instruction::Type::W, Instruction::Type::S,
+    Instruction::Type::A, Instruction::Type::D,
+    Instruction::Type::L, Instruction::Type::R, Instruction::Type::T,
+  };
+  std::mt19937 rng(7);
+  int num_steps = kPrefix.size();
+  for (int i = 0; i < 2000; ++i) {
+    if (rng() % 4 == 0 && num_steps > 0) {
+      map.UndoStep();
+      --num_steps;
+    } else {
+      // Step(), so that picked boosters become usable.
+      Instruction inst{kTypes[rng() % 7]};
+      if (inst.type == Instruction::Type::T && !map.reset_points().empty())
+        inst.arg = map.reset_points()[rng() % map.reset_points().size()];
+      if (map.Step({inst}).ok())
+        ++num_steps;
+    }
+    if (i % 5 == 0)
+      ExpectTeleportDistancesConsistent(map);
+  }
+
+  // Back to the start, removing the reset points after refilling walls.
+  for (; num_steps > 0; --num_steps) {
+    map.UndoStep();
+    if (num_steps % 3 == 0)
+      ExpectTeleportDistancesConsistent(map);
+  }
+  EXPECT_TRUE(map.reset_points().empty());
+  ExpectTeleportDistancesConsistent(map);
+
+  ASSERT_TRUE(Simulate(&map, ParseSolution(kPrefix)).failure ==
+              Map::RunResult::SUCCESS);
+  const auto snapshot = map.TakeSnapshot();
+  map.UndoStep();
+  map.UndoStep();
+  map.Restore(snapshot);
+  ExpectTeleportDistancesConsistent(map);
+}
+
+}  // namespace
+}  // namespace icfpc2019
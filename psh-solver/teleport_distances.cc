@@ -0,0 +1,138 @@
+#include "teleport_distances.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+
+TeleportDistances::TeleportDistances(
+    const std::vector<Cell>& cells, int width, int height)
+    : width_(width), height_(height), cells_(cells),
+      dist_(cells.size(), kUnreachable), seen_(cells.size(), 0) {}
+
+void TeleportDistances::AddResetPoint(int index) {
+  resets_.push_back(index);
+  if (stale_)
+    return;
+  logs_.emplace_back();
+  Relax(index, &logs_.back());
+}
+
+void TeleportDistances::RemoveLastResetPoint() {
+  CHECK(!resets_.empty()) << "No reset point to remove";
+  resets_.pop_back();
+  if (stale_)
+    return;
+  if (logs_.empty()) {
+    // Folded in by a rebuild, so can't be reverted.
+    stale_ = true;
+    return;
+  }
+  const auto& log = logs_.back();
+  for (auto iter = log.rbegin(); iter != log.rend(); ++iter) {
+    dist_[iter->first] = iter->second;
+  }
+  logs_.pop_back();
+}
+
+void TeleportDistances::RebuildInternal() const {
+  std::fill(dist_.begin(), dist_.end(), kUnreachable);
+  for (const int index : resets_) {
+    Relax(index, nullptr);
+  }
+  logs_.clear();
+  stale_ = false;
+}
+
+void TeleportDistances::Relax(
+    int index, std::vector<std::pair<int, std::int32_t>>* log) const {
+  if (dist_[index] == 0)
+    return;
+  if (log)
+    log->emplace_back(index, dist_[index]);
+  dist_[index] = 0;
+  // Cells which get closer are connected to |index| through such cells
+  // only, so the BFS needs not go beyond them.
+  frontier_.assign(1, {index, 0});
+  for (std::size_t head = 0; head < frontier_.size(); ++head) {
+    const std::int32_t d = frontier_[head].second + 1;
+    ForEachNeighbor(frontier_[head].first, [&](int next) {
+      if (!Passable(next) || dist_[next] <= d)
+        return;
+      if (log)
+        log->emplace_back(next, dist_[next]);
+      dist_[next] = d;
+      frontier_.emplace_back(next, d);
+    });
+  }
+}
+
+void TeleportDistances::BeginSearch(int source) const {
+  if (++search_id_ == 0) {
+    std::fill(seen_.begin(), seen_.end(), 0);
+    search_id_ = 1;
+  }
+  seen_[source] = search_id_;
+  frontier_.assign(1, {source, 0});
+}
+
+std::int32_t TeleportDistances::Distance(
+    const Point& source, const Point& target) const {
+  Rebuild();
+  const int s = source.y * width_ + source.x;
+  const int t = target.y * width_ + target.x;
+  if (s == t)
+    return 0;
+  const std::int32_t by_teleport =
+      dist_[t] == kUnreachable ? kUnreachable : dist_[t] + 1;
+
+  // Walking beyond a cell no sooner than by teleporting can't beat
+  // teleporting either, by the triangle inequality.
+  BeginSearch(s);
+  for (std::size_t head = 0; head < frontier_.size(); ++head) {
+    const std::int32_t d = frontier_[head].second + 1;
+    if (d >= by_teleport)
+      break;
+    bool found = false;
+    ForEachNeighbor(frontier_[head].first, [&](int next) {
+      if (!Passable(next) || seen_[next] == search_id_)
+        return;
+      seen_[next] = search_id_;
+      found = found || next == t;
+      if (dist_[next] == kUnreachable || d < dist_[next] + 1)
+        frontier_.emplace_back(next, d);
+    });
+    if (found)
+      return d;
+  }
+  return by_teleport;
+}
+
+void TeleportDistances::DistancesFrom(
+    const Point& source, std::vector<std::int32_t>* result) const {
+  Rebuild();
+  result->resize(dist_.size());
+  for (std::size_t i = 0; i < dist_.size(); ++i) {
+    (*result)[i] = dist_[i] == kUnreachable ? kUnreachable : dist_[i] + 1;
+  }
+
+  // Only cells reached sooner by walking are expanded; see Distance().
+  const int s = source.y * width_ + source.x;
+  (*result)[s] = 0;
+  BeginSearch(s);
+  for (std::size_t head = 0; head < frontier_.size(); ++head) {
+    const std::int32_t d = frontier_[head].second + 1;
+    ForEachNeighbor(frontier_[head].first, [&](int next) {
+      if (!Passable(next) || seen_[next] == search_id_)
+        return;
+      seen_[next] = search_id_;
+      if (d < (*result)[next]) {
+        (*result)[next] = d;
+        frontier_.emplace_back(next, d);
+      }
+    });
+  }
+}
+
+}  // namespace icfpc2019
@@ -0,0 +1,110 @@
+#ifndef TELEPORT_DISTANCES_H_
+#define TELEPORT_DISTANCES_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Shortest travel times (in time units, walls are impassable) counting
+// teleports to installed reset points. A teleport takes one time unit from
+// anywhere, so the time from s to t is
+//   min(walk(s, t), 1 + min over reset points r of walk(r, t)),
+// walking after a teleport only, and teleporting at most once.
+//
+// The source-independent part, the walking distance from the nearest reset
+// point (beacon_distance()), is kept as a multi-source BFS field. Installing
+// a reset point relaxes it by a BFS from the new one, through the cells it
+// gets closer to only, and logs their old values so that removing the last
+// installed one (as Map::Undo() does) reverts them. Changes of walls
+// (drilling) make the field be rebuilt lazily on the next query.
+//
+// Queries are const but may rebuild the field and use scratch space, so a
+// TeleportDistances must not be queried from multiple threads at once.
+class TeleportDistances {
+ public:
+  static constexpr std::int32_t kUnreachable = 1 << 30;
+
+  TeleportDistances() = default;
+  // |cells| is the grid in Map::Index() order.
+  TeleportDistances(const std::vector<Cell>& cells, int width, int height);
+
+  // Must be called when the cell at |index| changes to |cell|. Only changes
+  // between WALL and the rest matter.
+  void Update(int index, Cell cell) {
+    if ((cells_[index] == Cell::WALL) != (cell == Cell::WALL))
+      stale_ = true;
+    cells_[index] = cell;
+  }
+
+  // Must be called when a reset point is installed at |index|, and when the
+  // last installed one is removed.
+  void AddResetPoint(int index);
+  void RemoveLastResetPoint();
+
+  // Walking distance from the nearest reset point to |p|, or kUnreachable.
+  std::int32_t beacon_distance(const Point& p) const {
+    Rebuild();
+    return dist_[p.y * width_ + p.x];
+  }
+
+  // Time units from |source| to |target|, or kUnreachable. The BFS from
+  // |source| stops as soon as teleporting can't be beaten.
+  std::int32_t Distance(const Point& source, const Point& target) const;
+
+  // Time units from |source| to every cell, in Map::Index() order.
+  void DistancesFrom(const Point& source,
+                     std::vector<std::int32_t>* result) const;
+
+ private:
+  void Rebuild() const {
+    if (stale_)
+      RebuildInternal();
+  }
+  void RebuildInternal() const;
+
+  // Relaxes |dist_| by a BFS from |index|, logging the old values if
+  // |log| is not nullptr.
+  void Relax(int index,
+             std::vector<std::pair<int, std::int32_t>>* log) const;
+
+  // Starts a BFS from |source| over |frontier_|, marking |seen_|.
+  void BeginSearch(int source) const;
+
+  bool Passable(int index) const { return cells_[index] != Cell::WALL; }
+
+  template <typename Fn>
+  void ForEachNeighbor(int index, Fn fn) const {
+    const int x = index % width_;
+    if (x + 1 < width_) fn(index + 1);
+    if (x > 0) fn(index - 1);
+    if (index + width_ < static_cast<int>(cells_.size())) fn(index + width_);
+    if (index >= width_) fn(index - width_);
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<Cell> cells_;
+  // Installed reset points, in installed order.
+  std::vector<int> resets_;
+
+  // Lazily rebuilt state.
+  mutable bool stale_ = false;
+  mutable std::vector<std::int32_t> dist_;
+  // Cells improved by each of the last logs_.size() reset points, with
+  // their old distances. Earlier ones were folded in by a rebuild.
+  mutable std::vector<std::vector<std::pair<int, std::int32_t>>> logs_;
+
+  // Scratch space for the BFS from a source. A cell is seen iff its
+  // |seen_| equals |search_id_|.
+  mutable std::vector<std::uint32_t> seen_;
+  mutable std::uint32_t search_id_ = 0;
+  mutable std::vector<std::pair<int, std::int32_t>> frontier_;
+};
+
+}  // namespace icfpc2019
+
+#endif  // TELEPORT_DISTANCES_H_
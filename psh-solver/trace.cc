@@ -0,0 +1,69 @@
+#include "trace.h"
+
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace icfpc2019 {
+namespace {
+
+constexpr char kMagic[8] = {'P', 'S', 'H', 'T', 'R', 'A', 'C', 'E'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::size_t kBufferSize = 4096;
+
+}  // namespace
+
+TraceWriter::TraceWriter(const std::string& path, int width, int height)
+    : file_(std::fopen(path.c_str(), "wb")), path_(path) {
+  PCHECK(file_) << "Failed to create " << path;
+  TraceHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.record_size = sizeof(TraceRecord);
+  header.width = width;
+  header.height = height;
+  PCHECK(std::fwrite(&header, sizeof(header), 1, file_) == 1) << path_;
+  buffer_.reserve(kBufferSize);
+}
+
+TraceWriter::~TraceWriter() {
+  Flush();
+  PCHECK(std::fclose(file_) == 0) << path_;
+}
+
+void TraceWriter::AppendStep(absl::Span<TraceRecord> records) {
+  for (auto& record : records) {
+    record.step = step_;
+    buffer_.push_back(record);
+  }
+  ++step_;
+  if (buffer_.size() >= kBufferSize)
+    Flush();
+}
+
+void TraceWriter::Flush() {
+  if (buffer_.empty())
+    return;
+  PCHECK(std::fwrite(buffer_.data(), sizeof(TraceRecord), buffer_.size(),
+                     file_) == buffer_.size()) << path_;
+  buffer_.clear();
+}
+
+TraceReader::TraceReader(absl::string_view contents) {
+  CHECK_GE(contents.size(), sizeof(TraceHeader)) << "Not a trace";
+  CHECK_EQ(reinterpret_cast<std::uintptr_t>(contents.data()) %
+           alignof(TraceRecord), 0u);
+  header_ = reinterpret_cast<const TraceHeader*>(contents.data());
+  CHECK(std::memcmp(header_->magic, kMagic, sizeof(kMagic)) == 0)
+      << "Not a trace";
+  CHECK_EQ(header_->version, kVersion) << "Unknown trace version";
+  CHECK_EQ(header_->record_size, sizeof(TraceRecord));
+  const std::size_t size = contents.size() - sizeof(TraceHeader);
+  CHECK_EQ(size % sizeof(TraceRecord), 0u) << "Truncated trace";
+  records_ = absl::MakeConstSpan(
+      reinterpret_cast<const TraceRecord*>(contents.data() +
+                                           sizeof(TraceHeader)),
+      size / sizeof(TraceRecord));
+}
+
+}  // namespace icfpc2019
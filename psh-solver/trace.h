@@ -0,0 +1,86 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace icfpc2019 {
+
+// What one wrapper did in one time unit of Map::Step().
+struct TraceRecord {
+  std::int32_t step;
+  // Unwrapped cells left after the action.
+  std::int32_t remaining;
+  // Position after the action.
+  std::int16_t x;
+  std::int16_t y;
+  std::uint16_t wrapper;
+  // Cells newly wrapped by the action.
+  std::uint16_t wrapped;
+  // Instruction::Type run by the wrapper; Z also for wrappers left idle.
+  std::uint8_t instruction;
+  // Booster picked up by the action, or Booster::X.
+  std::uint8_t picked;
+  std::uint8_t padding[2];
+};
+static_assert(sizeof(TraceRecord) == 20, "TraceRecord should be packed");
+
+// A trace file is a header followed by TraceRecords in step order, and in
+// wrapper order within a step, all in the native byte order. Records are
+// fixed width so that a reader can map the file and index it directly.
+struct TraceHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t record_size;
+  std::int32_t width;
+  std::int32_t height;
+};
+static_assert(sizeof(TraceHeader) == 24, "TraceHeader should be packed");
+
+// Appends the steps of a Map to a trace file. Set by Map::set_trace().
+class TraceWriter {
+ public:
+  // Dies if |path| cannot be created.
+  TraceWriter(const std::string& path, int width, int height);
+  ~TraceWriter();
+
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  // Appends the records of the next step, setting their |step|.
+  void AppendStep(absl::Span<TraceRecord> records);
+
+  // Writes out the buffered records.
+  void Flush();
+
+ private:
+  std::FILE* file_;
+  std::string path_;
+  std::int32_t step_ = 0;
+  std::vector<TraceRecord> buffer_;
+};
+
+// View of the contents of a trace file.
+class TraceReader {
+ public:
+  // Dies if |contents| is not a trace. |contents| must outlive this, and be
+  // 4-byte aligned (as MappedFile::contents() is).
+  explicit TraceReader(absl::string_view contents);
+
+  int width() const { return header_->width; }
+  int height() const { return header_->height; }
+  absl::Span<const TraceRecord> records() const { return records_; }
+
+ private:
+  const TraceHeader* header_;
+  absl::Span<const TraceRecord> records_;
+};
+
+}  // namespace icfpc2019
+
+#endif  // TRACE_H_
@@ -0,0 +1,118 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "mapped_file.h"
+#include "simulator.h"
+
+DEFINE_int32(buckets, 20, "Number of rows of the wrap rate curve.");
+
+namespace icfpc2019 {
+namespace {
+
+bool UsesBooster(Instruction::Type type) {
+  switch (type) {
+    case Instruction::Type::B:
+    case Instruction::Type::F:
+    case Instruction::Type::L:
+    case Instruction::Type::R:
+    case Instruction::Type::C:
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct WrapperSummary {
+  int actions = 0;
+  // Z, or no instruction at all.
+  int idle = 0;
+  // Acted, but wrapped nothing.
+  int unproductive = 0;
+  int wrapped = 0;
+  int picked = 0;
+  int used = 0;
+};
+
+void Summarize(const TraceReader& trace) {
+  const auto records = trace.records();
+  if (records.empty()) {
+    std::cout << "Empty trace\n";
+    return;
+  }
+  const int num_steps = records.back().step + 1;
+  std::vector<WrapperSummary> wrappers;
+  for (const auto& record : records) {
+    if (record.wrapper >= wrappers.size())
+      wrappers.resize(record.wrapper + 1);
+    auto& summary = wrappers[record.wrapper];
+    const auto type = static_cast<Instruction::Type>(record.instruction);
+    ++summary.actions;
+    if (type == Instruction::Type::Z) {
+      ++summary.idle;
+    } else if (record.wrapped == 0) {
+      ++summary.unproductive;
+    }
+    summary.wrapped += record.wrapped;
+    summary.picked += static_cast<Booster>(record.picked) != Booster::X;
+    summary.used += UsesBooster(type);
+  }
+
+  std::cout << "map\t" << trace.width() << "x" << trace.height() << "\n"
+            << "steps\t" << num_steps << "\n"
+            << "remaining\t" << records.back().remaining << "\n\n";
+
+  std::cout << "wrapper\tsteps\tidle\tunproductive\twrapped\tpicked\tused\n";
+  for (std::size_t i = 0; i < wrappers.size(); ++i) {
+    const auto& summary = wrappers[i];
+    std::cout << i << '\t' << summary.actions << '\t' << summary.idle << '\t'
+              << summary.unproductive << '\t' << summary.wrapped << '\t'
+              << summary.picked << '\t' << summary.used << '\n';
+  }
+
+  // Wrap rate per range of steps, and what is left at its end.
+  const int buckets = std::max(1, std::min(FLAGS_buckets, num_steps));
+  std::cout << "\nfirst_step\tlast_step\twrapped\twrapped_per_step"
+               "\tremaining\n";
+  std::size_t i = 0;
+  for (int bucket = 0; bucket < buckets; ++bucket) {
+    const int begin = static_cast<std::int64_t>(num_steps) * bucket / buckets;
+    const int end =
+        static_cast<std::int64_t>(num_steps) * (bucket + 1) / buckets;
+    int wrapped = 0;
+    int remaining = 0;
+    for (; i < records.size() && records[i].step < end; ++i) {
+      wrapped += records[i].wrapped;
+      remaining = records[i].remaining;
+    }
+    std::cout << begin << '\t' << end - 1 << '\t' << wrapped << '\t'
+              << static_cast<double>(wrapped) / (end - begin) << '\t'
+              << remaining << '\n';
+  }
+}
+
+}  // namespace
+}  // namespace icfpc2019
+
+// Summarizes a trace written by `verifier --trace`: per wrapper, how many
+// steps it was idle or wrapped nothing, and the wrap rate over time.
+int main(int argc, char* argv[]) {
+  gflags::SetUsageMessage("trace_tool trace.bin");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (argc != 2) {
+    gflags::ShowUsageWithFlags(argv[0]);
+    return 2;
+  }
+
+  const icfpc2019::MappedFile file(argv[1]);
+  icfpc2019::Summarize(icfpc2019::TraceReader(file.contents()));
+  return 0;
+}
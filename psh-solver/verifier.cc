@@ -1,35 +1,37 @@
 #include "simulator.h"
 
-#include <fstream>
-#include <iterator>
 #include <iostream>
-#include "glog/logging.h"
-
-namespace {
 
-std::string ReadFile(const std::string path) {
-  std::ifstream fin(path);
-  CHECK(fin);
+#include "absl/types/optional.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
 
-  return std::string(
-    std::istreambuf_iterator<char>(fin),
-    std::istreambuf_iterator<char>());
-}
+#include "mapped_file.h"
+#include "trace.h"
 
-} // namespace
+DEFINE_string(trace, "",
+              "If set, writes a per-step trace of the solution to this path, "
+              "to be summarized by trace_tool.");
 
 int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
   if (argc != 3) {
     std::cerr << "Usage: " << argv[0] << " [prob-XXX.desc] [prob-XXX.sol]";
     return 2;
   }
 
-  auto desc_content = ReadFile(argv[1]);
-  auto sol_content = ReadFile(argv[2]);
+  const icfpc2019::MappedFile desc_file(argv[1]);
+  const icfpc2019::MappedFile sol_file(argv[2]);
 
-  auto desc = icfpc2019::ParseDesc(desc_content);
+  auto desc = icfpc2019::ParseDesc(desc_file.contents());
   auto map = icfpc2019::Map(desc);
-  auto sol = icfpc2019::ParseSolution(sol_content);
+  icfpc2019::SolutionReader sol(sol_file.contents());
+
+  absl::optional<icfpc2019::TraceWriter> trace;
+  if (!FLAGS_trace.empty()) {
+    trace.emplace(FLAGS_trace, map.width(), map.height());
+    map.set_trace(&*trace);
+  }
 
-  return !icfpc2019::Verify(&map, sol);
+  return !icfpc2019::Verify(&map, &sol);
 }
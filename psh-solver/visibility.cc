@@ -0,0 +1,73 @@
+#include "visibility.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "rational.h"
+
+namespace icfpc2019 {
+
+std::vector<Point> CrossedCells(const Point& d) {
+  std::vector<Point> points;
+  if (d.x == 0) {
+    int miny, maxy;
+    std::tie(miny, maxy) = std::minmax(0, d.y);
+    for (int y = miny; y <= maxy; ++y) {
+      points.push_back(Point{0, y});
+    }
+    return points;
+  }
+
+  Point s{0, 0}, g = d;
+  if (s.x > g.x) {
+    std::swap(s, g);
+  }
+
+  const auto grad = Rational(g.y - s.y, g.x - s.x);
+  for (int x = s.x; x <= g.x; ++x) {
+    auto left = std::max(Rational(s.x), Rational(x) - Rational(1, 2));
+    auto right = std::min(Rational(g.x), Rational(x) + Rational(1, 2));
+
+    auto left_y =
+        Rational(s.y) + (left - Rational(s.x)) * grad + Rational(1, 2);
+    auto right_y =
+        Rational(s.y) + (right - Rational(s.x)) * grad + Rational(1, 2);
+    int lo = std::min(Floor(left_y), Floor(right_y));
+    int hi = std::max(Ceil(left_y), Ceil(right_y));
+    for (int y = lo; y < hi; ++y) {
+      points.push_back(Point{x, y});
+    }
+  }
+  return points;
+}
+
+const VisibilityTable& VisibilityTable::Get() {
+  static const VisibilityTable* table = new VisibilityTable();
+  return *table;
+}
+
+VisibilityTable::VisibilityTable() {
+  begin_.reserve(kSide * kSide + 1);
+  for (int dy = -kMaxReach; dy <= kMaxReach; ++dy) {
+    for (int dx = -kMaxReach; dx <= kMaxReach; ++dx) {
+      begin_.push_back(cells_.size());
+      for (const auto& p : CrossedCells(Point{dx, dy})) {
+        cells_.push_back(Offset{static_cast<std::int8_t>(p.x),
+                                static_cast<std::int8_t>(p.y)});
+      }
+    }
+  }
+  begin_.push_back(cells_.size());
+
+  for (int dy = -kWindowReach; dy <= kWindowReach; ++dy) {
+    for (int dx = -kWindowReach; dx <= kWindowReach; ++dx) {
+      std::uint32_t mask = 0;
+      for (const auto& cell : Cells(Point{dx, dy})) {
+        mask |= 1u << WindowBit(Point{cell.dx, cell.dy});
+      }
+      window_masks_[WindowBit(Point{dx, dy})] = mask;
+    }
+  }
+}
+
+}  // namespace icfpc2019
@@ -0,0 +1,89 @@
+#ifndef VISIBILITY_H_
+#define VISIBILITY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/types/span.h"
+
+#include "grid.h"
+
+namespace icfpc2019 {
+
+// Returns the cells, relative to the origin, which the segment between the
+// center of the origin cell and the center of the cell at |d| passes
+// through. Both end cells are included.
+std::vector<Point> CrossedCells(const Point& d);
+
+// Precomputed CrossedCells() for every offset within kMaxReach in both
+// axes. Visibility of a manipulator depends only on its offset from the
+// wrapper, so Map::Fill() can just walk the list instead of doing Rational
+// arithmetic each time.
+class VisibilityTable {
+ public:
+  // Manipulators are attached adjacently one by one, so arms rarely reach
+  // beyond a few cells. Offsets beyond this fall back to CrossedCells().
+  static constexpr int kMaxReach = 16;
+
+  struct Offset {
+    std::int8_t dx;
+    std::int8_t dy;
+  };
+
+  // Returns the table shared by all Map instances. It is built on the first
+  // call, and is read-only (thus thread-safe) afterwards.
+  static const VisibilityTable& Get();
+
+  bool Contains(const Point& d) const {
+    return -kMaxReach <= d.x && d.x <= kMaxReach &&
+        -kMaxReach <= d.y && d.y <= kMaxReach;
+  }
+
+  // |d| must be Contains()-ed.
+  absl::Span<const Offset> Cells(const Point& d) const {
+    const int index = Slot(d);
+    return absl::MakeConstSpan(
+        cells_.data() + begin_[index], begin_[index + 1] - begin_[index]);
+  }
+
+  // Arms within kWindowReach, which covers the default manipulators and the
+  // first extensions, are decided by a bitmask of the walls in the window
+  // of kWindowSide x kWindowSide cells centered at the wrapper (see
+  // Terrain::wall_window()): the arm at |d| is visible iff the walls and
+  // WindowMask(d) don't intersect.
+  static constexpr int kWindowReach = 2;
+  static constexpr int kWindowSide = 2 * kWindowReach + 1;
+  static_assert(kWindowSide * kWindowSide <= 32, "Window must fit in 32 bits");
+
+  static bool InWindow(const Point& d) {
+    return -kWindowReach <= d.x && d.x <= kWindowReach &&
+        -kWindowReach <= d.y && d.y <= kWindowReach;
+  }
+  // Bit of the cell at |d| from the center of a window.
+  static int WindowBit(const Point& d) {
+    return (d.y + kWindowReach) * kWindowSide + (d.x + kWindowReach);
+  }
+
+  // Window bits of Cells(d). |d| must be InWindow().
+  std::uint32_t WindowMask(const Point& d) const {
+    return window_masks_[WindowBit(d)];
+  }
+
+ private:
+  static constexpr int kSide = 2 * kMaxReach + 1;
+
+  VisibilityTable();
+
+  static int Slot(const Point& d) {
+    return (d.y + kMaxReach) * kSide + (d.x + kMaxReach);
+  }
+
+  // Cells for the offset at slot i are cells_[begin_[i], begin_[i + 1]).
+  std::vector<std::uint32_t> begin_;
+  std::vector<Offset> cells_;
+  std::uint32_t window_masks_[kWindowSide * kWindowSide];
+};
+
+}  // namespace icfpc2019
+
+#endif  // VISIBILITY_H_
@@ -0,0 +1,91 @@
+#include "visibility.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "gtest/gtest.h"
+
+namespace icfpc2019 {
+namespace {
+
+// Non-negative-denominator fraction, only for comparison.
+struct Frac {
+  std::int64_t num;
+  std::int64_t den;
+};
+
+Frac MakeFrac(std::int64_t num, std::int64_t den) {
+  return den < 0 ? Frac{-num, -den} : Frac{num, den};
+}
+
+bool operator<(const Frac& lhs, const Frac& rhs) {
+  return lhs.num * rhs.den < rhs.num * lhs.den;
+}
+
+// Whether the segment between the centers of (0, 0) and |d| passes through
+// the interior of the cell |c|. Coordinates are doubled so that the centers
+// are integral.
+bool Crosses(const Point& d, const Point& c) {
+  const std::int64_t ax = 1, ay = 1;
+  const std::int64_t vx = 2 * d.x, vy = 2 * d.y;
+  Frac lo = {0, 1}, hi = {1, 1};
+  bool open_lo = false, open_hi = false;
+
+  auto clip = [&](std::int64_t a, std::int64_t v, std::int64_t cmin) {
+    const std::int64_t cmax = cmin + 2;
+    if (v == 0)
+      return cmin < a && a < cmax;
+    Frac t1 = MakeFrac(cmin - a, v), t2 = MakeFrac(cmax - a, v);
+    if (t2 < t1)
+      std::swap(t1, t2);
+    if (!(t1 < lo)) {
+      lo = t1;
+      open_lo = true;
+    }
+    if (!(hi < t2)) {
+      hi = t2;
+      open_hi = true;
+    }
+    return true;
+  };
+  if (!clip(ax, vx, 2 * c.x) || !clip(ay, vy, 2 * c.y))
+    return false;
+  if (open_lo || open_hi)
+    return lo < hi;
+  return !(hi < lo);
+}
+
+TEST(VisibilityTest, TableMatchesExactIntersection) {
+  const auto& table = VisibilityTable::Get();
+  constexpr int kReach = VisibilityTable::kMaxReach;
+  for (int dy = -kReach; dy <= kReach; ++dy) {
+    for (int dx = -kReach; dx <= kReach; ++dx) {
+      const Point d{dx, dy};
+      ASSERT_TRUE(table.Contains(d));
+      std::vector<Point> expected;
+      for (int y = std::min(0, dy); y <= std::max(0, dy); ++y) {
+        for (int x = std::min(0, dx); x <= std::max(0, dx); ++x) {
+          if (Crosses(d, Point{x, y}))
+            expected.push_back(Point{x, y});
+        }
+      }
+      std::vector<Point> actual;
+      for (const auto& cell : table.Cells(d))
+        actual.push_back(Point{cell.dx, cell.dy});
+      std::sort(expected.begin(), expected.end());
+      std::sort(actual.begin(), actual.end());
+      EXPECT_EQ(expected, actual) << "offset " << d;
+    }
+  }
+}
+
+TEST(VisibilityTest, FallsBackBeyondTable) {
+  const auto& table = VisibilityTable::Get();
+  const Point d{VisibilityTable::kMaxReach + 1, 0};
+  EXPECT_FALSE(table.Contains(d));
+  EXPECT_EQ(static_cast<std::size_t>(d.x + 1), CrossedCells(d).size());
+}
+
+}  // namespace
+}  // namespace icfpc2019